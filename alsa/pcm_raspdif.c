@@ -0,0 +1,330 @@
+#include <alsa/asoundlib.h>
+#include <alsa/pcm_external.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "raspdif_client.h"
+
+/**
+  @brief  ALSA external PCM plugin which writes to the raspdif shared memory ring.
+          Position and delay are reported from the daemon's DMA position
+*/
+
+typedef struct snd_pcm_raspdif_t
+{
+  snd_pcm_ioplug_t io;
+  raspdif_client_t* client;
+  int32_t timer_fd; // Wakes poll once per period to check for space
+  uint64_t written; // Frames written to the ring before prepare
+} snd_pcm_raspdif_t;
+
+/**
+  @brief  Arm or disarm the period timer
+
+  @param  raspdif Plugin object
+  @param  enable Arm the timer
+  @retval int - 0 on success, negative errno on error
+*/
+static int snd_pcm_raspdif_set_timer(snd_pcm_raspdif_t* raspdif, bool enable)
+{
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+
+  if (enable)
+  {
+    uint64_t period_ns = (uint64_t)raspdif->io.period_size * 1000000000 / raspdif->io.rate;
+
+    spec.it_interval.tv_sec = period_ns / 1000000000;
+    spec.it_interval.tv_nsec = period_ns % 1000000000;
+    spec.it_value = spec.it_interval;
+  }
+
+  if (timerfd_settime(raspdif->timer_fd, 0, &spec, NULL) == -1)
+    return -errno;
+
+  return 0;
+}
+
+/**
+  @brief  Start the stream
+
+  @param  io ioplug handle
+  @retval int
+*/
+static int snd_pcm_raspdif_start(snd_pcm_ioplug_t* io)
+{
+  return snd_pcm_raspdif_set_timer(io->private_data, true);
+}
+
+/**
+  @brief  Stop the stream. Frames already in the ring will still be transmitted
+
+  @param  io ioplug handle
+  @retval int
+*/
+static int snd_pcm_raspdif_stop(snd_pcm_ioplug_t* io)
+{
+  return snd_pcm_raspdif_set_timer(io->private_data, false);
+}
+
+/**
+  @brief  Prepare the stream and reset the hardware position
+
+  @param  io ioplug handle
+  @retval int
+*/
+static int snd_pcm_raspdif_prepare(snd_pcm_ioplug_t* io)
+{
+  snd_pcm_raspdif_t* raspdif = io->private_data;
+
+  // Frames of an earlier stream still playing out don't advance this one
+  raspdif->written = raspdif_client_consumed(raspdif->client) + raspdif_client_queued(raspdif->client);
+
+  return 0;
+}
+
+/**
+  @brief  Get the hardware position. Advances as the DMA transmits frames
+
+  @param  io ioplug handle
+  @retval snd_pcm_sframes_t - Position within buffer
+*/
+static snd_pcm_sframes_t snd_pcm_raspdif_pointer(snd_pcm_ioplug_t* io)
+{
+  snd_pcm_raspdif_t* raspdif = io->private_data;
+
+  uint64_t played = raspdif_client_played(raspdif->client);
+  uint64_t position = (played > raspdif->written) ? played - raspdif->written : 0;
+
+  return position % io->buffer_size;
+}
+
+/**
+  @brief  Check the daemon still expects the negotiated format and rate
+
+  @param  raspdif Plugin object
+  @retval bool
+*/
+static bool snd_pcm_raspdif_matches(snd_pcm_raspdif_t* raspdif)
+{
+  snd_pcm_format_t format = raspdif_client_is_s24le(raspdif->client) ? SND_PCM_FORMAT_S24_3LE : SND_PCM_FORMAT_S16_LE;
+
+  return raspdif->io.format == format && raspdif->io.rate == raspdif_client_rate(raspdif->client);
+}
+
+/**
+  @brief  Copy frames from the application into the ring
+
+  @param  io ioplug handle
+  @param  areas Channel areas of application buffer
+  @param  offset Offset of first frame in areas
+  @param  size Number of frames to transfer
+  @retval snd_pcm_sframes_t - Number of frames transferred
+*/
+static snd_pcm_sframes_t snd_pcm_raspdif_transfer(snd_pcm_ioplug_t* io, const snd_pcm_channel_area_t* areas, snd_pcm_uframes_t offset, snd_pcm_uframes_t size)
+{
+  snd_pcm_raspdif_t* raspdif = io->private_data;
+
+  // Daemon switched format or rate under the stream. The application must reopen the device
+  if (!snd_pcm_raspdif_matches(raspdif))
+    return -ENODEV;
+
+  // Interleaved access so all channels share the first area
+  const uint8_t* frames = (const uint8_t*)areas[0].addr + (areas[0].first + areas[0].step * offset) / 8;
+
+  return raspdif_client_write(raspdif->client, frames, size, false);
+}
+
+/**
+  @brief  Get the delay until a newly written frame is transmitted
+
+  @param  io ioplug handle
+  @param  delay Delay in frames
+  @retval int
+*/
+static int snd_pcm_raspdif_delay(snd_pcm_ioplug_t* io, snd_pcm_sframes_t* delay)
+{
+  snd_pcm_raspdif_t* raspdif = io->private_data;
+
+  *delay = raspdif_client_delay(raspdif->client);
+
+  return 0;
+}
+
+/**
+  @brief  Block until all written frames have been transmitted
+
+  @param  io ioplug handle
+  @retval int
+*/
+static int snd_pcm_raspdif_drain(snd_pcm_ioplug_t* io)
+{
+  snd_pcm_raspdif_t* raspdif = io->private_data;
+
+  uint32_t period_us = (uint64_t)io->period_size * 1000000 / io->rate;
+  while (raspdif_client_delay(raspdif->client) > 0)
+    usleep(period_us);
+
+  return snd_pcm_raspdif_set_timer(raspdif, false);
+}
+
+/**
+  @brief  Translate poll events on the period timer
+
+  @param  io ioplug handle
+  @param  pfd Poll descriptors
+  @param  nfds Number of poll descriptors
+  @param  revents Translated events
+  @retval int
+*/
+static int snd_pcm_raspdif_poll_revents(snd_pcm_ioplug_t* io, struct pollfd* pfd, unsigned int nfds, unsigned short* revents)
+{
+  snd_pcm_raspdif_t* raspdif = io->private_data;
+
+  // Acknowledge timer expirations
+  uint64_t expirations = 0;
+  if (pfd[0].revents & POLLIN)
+    read(raspdif->timer_fd, &expirations, sizeof(expirations));
+
+  *revents = (raspdif_client_avail(raspdif->client) >= io->period_size) ? POLLOUT : 0;
+
+  return 0;
+}
+
+/**
+  @brief  Close the PCM and detach from the daemon
+
+  @param  io ioplug handle
+  @retval int
+*/
+static int snd_pcm_raspdif_close(snd_pcm_ioplug_t* io)
+{
+  snd_pcm_raspdif_t* raspdif = io->private_data;
+
+  raspdif_client_close(raspdif->client);
+  close(raspdif->timer_fd);
+  free(raspdif);
+
+  return 0;
+}
+
+static const snd_pcm_ioplug_callback_t snd_pcm_raspdif_callback = {
+  .start = snd_pcm_raspdif_start,
+  .stop = snd_pcm_raspdif_stop,
+  .pointer = snd_pcm_raspdif_pointer,
+  .transfer = snd_pcm_raspdif_transfer,
+  .close = snd_pcm_raspdif_close,
+  .prepare = snd_pcm_raspdif_prepare,
+  .drain = snd_pcm_raspdif_drain,
+  .delay = snd_pcm_raspdif_delay,
+  .poll_revents = snd_pcm_raspdif_poll_revents,
+};
+
+/**
+  @brief  Restrict hardware parameters to what the daemon expects
+
+  @param  raspdif Plugin object
+  @retval int
+*/
+static int snd_pcm_raspdif_set_hw_constraints(snd_pcm_raspdif_t* raspdif)
+{
+  static const unsigned int access[] = {SND_PCM_ACCESS_RW_INTERLEAVED};
+  unsigned int format[] = {raspdif_client_is_s24le(raspdif->client) ? SND_PCM_FORMAT_S24_3LE : SND_PCM_FORMAT_S16_LE};
+
+  uint8_t frame_size = raspdif_client_frame_size(raspdif->client);
+  uint32_t capacity = raspdif_client_avail(raspdif->client) + raspdif_client_queued(raspdif->client);
+
+  int result = 0;
+  if ((result = snd_pcm_ioplug_set_param_list(&raspdif->io, SND_PCM_IOPLUG_HW_ACCESS, 1, access)) < 0 ||
+      (result = snd_pcm_ioplug_set_param_list(&raspdif->io, SND_PCM_IOPLUG_HW_FORMAT, 1, format)) < 0 ||
+      (result = snd_pcm_ioplug_set_param_minmax(&raspdif->io, SND_PCM_IOPLUG_HW_CHANNELS, 2, 2)) < 0 ||
+      (result = snd_pcm_ioplug_set_param_minmax(&raspdif->io, SND_PCM_IOPLUG_HW_RATE, raspdif_client_rate(raspdif->client), raspdif_client_rate(raspdif->client))) < 0 ||
+      (result = snd_pcm_ioplug_set_param_minmax(&raspdif->io, SND_PCM_IOPLUG_HW_PERIOD_BYTES, 64 * frame_size, capacity * frame_size / 2)) < 0 ||
+      (result = snd_pcm_ioplug_set_param_minmax(&raspdif->io, SND_PCM_IOPLUG_HW_BUFFER_BYTES, 128 * frame_size, capacity * frame_size)) < 0 ||
+      (result = snd_pcm_ioplug_set_param_minmax(&raspdif->io, SND_PCM_IOPLUG_HW_PERIODS, 2, 1024)) < 0)
+    return result;
+
+  return 0;
+}
+
+/**
+  @brief  Plugin entry point. Attaches to the daemon's shared memory ring
+*/
+SND_PCM_PLUGIN_DEFINE_FUNC(raspdif)
+{
+  snd_config_iterator_t i, next;
+  snd_config_for_each(i, next, conf)
+  {
+    snd_config_t* n = snd_config_iterator_entry(i);
+    const char* id;
+    if (snd_config_get_id(n, &id) < 0)
+      continue;
+
+    if (strcmp(id, "comment") == 0 || strcmp(id, "type") == 0 || strcmp(id, "hint") == 0)
+      continue;
+
+    SNDERR("Unknown field %s", id);
+    return -EINVAL;
+  }
+
+  if (stream != SND_PCM_STREAM_PLAYBACK)
+  {
+    SNDERR("raspdif only supports playback");
+    return -EINVAL;
+  }
+
+  snd_pcm_raspdif_t* raspdif = calloc(1, sizeof(snd_pcm_raspdif_t));
+  if (raspdif == NULL)
+    return -ENOMEM;
+
+  raspdif->client = raspdif_client_open();
+  if (raspdif->client == NULL)
+  {
+    int result = -errno;
+    SNDERR("Failed to attach to raspdif. Is it running with --shared-memory? Error: %s", strerror(errno));
+    free(raspdif);
+    return result;
+  }
+
+  raspdif->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (raspdif->timer_fd == -1)
+  {
+    int result = -errno;
+    raspdif_client_close(raspdif->client);
+    free(raspdif);
+    return result;
+  }
+
+  raspdif->io.version = SND_PCM_IOPLUG_VERSION;
+  raspdif->io.name = "raspdif S/PDIF";
+  raspdif->io.callback = &snd_pcm_raspdif_callback;
+  raspdif->io.private_data = raspdif;
+  raspdif->io.poll_fd = raspdif->timer_fd;
+  raspdif->io.poll_events = POLLIN;
+  raspdif->io.mmap_rw = 0;
+
+  int result = snd_pcm_ioplug_create(&raspdif->io, name, stream, mode);
+  if (result < 0)
+  {
+    raspdif_client_close(raspdif->client);
+    close(raspdif->timer_fd);
+    free(raspdif);
+    return result;
+  }
+
+  if ((result = snd_pcm_raspdif_set_hw_constraints(raspdif)) < 0)
+  {
+    snd_pcm_ioplug_delete(&raspdif->io);
+    return result;
+  }
+
+  *pcmp = raspdif->io.pcm;
+
+  return 0;
+}
+
+SND_PCM_PLUGIN_SYMBOL(raspdif);
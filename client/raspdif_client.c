@@ -0,0 +1,421 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#include "raspdif_client.h"
+#include "raspdif_shm.h"
+
+struct raspdif_client_t
+{
+  int32_t fd;
+  raspdif_shm_t* shm;
+  uint32_t generation;       // Daemon generation the frame size and tail belong to
+  uint32_t write_generation; // Generation at the last begin. Commits under another are dropped
+  uint8_t frame_size;        // Frame size of the format at generation
+  uint32_t tail;             // Tail at last update of consumed
+  uint64_t consumed;         // Frames consumed by the daemon since open
+  uint64_t played;           // Frames transmitted since open. Never decreases
+};
+
+/**
+  @brief  Get the size of a stereo frame in a format
+
+  @param  format Sample format
+  @retval uint8_t - Frame size in bytes
+*/
+static uint8_t raspdif_client_format_frame_size(uint32_t format)
+{
+  return 2 * ((format == raspdif_shm_format_s24le) ? 3 : sizeof(int16_t));
+}
+
+/**
+  @brief  Pick up a format or rate switch by the daemon. The ring restarts on a
+          switch, so the tail is taken again and frames consumed since the last
+          update of consumed are not counted
+
+  @param  client Client handle
+  @retval bool - Client matches the daemon. False while a switch is in progress
+*/
+static bool raspdif_client_sync(raspdif_client_t* client)
+{
+  raspdif_shm_t* shm = client->shm;
+
+  uint32_t generation = atomic_load(&shm->generation);
+  if (generation & 1)
+    return false;
+
+  if (generation == client->generation)
+    return true;
+
+  uint8_t frame_size = raspdif_client_format_frame_size(shm->format);
+  uint32_t tail = atomic_load(&shm->tail);
+
+  // Another switch started while reading
+  if (atomic_load(&shm->generation) != generation)
+    return false;
+
+  client->generation = generation;
+  client->frame_size = frame_size;
+  client->tail = tail;
+
+  return true;
+}
+
+/**
+  @brief  Attach to the shared memory ring of a running daemon
+
+  @param  none
+  @retval raspdif_client_t* - Client handle. NULL on error with errno set
+*/
+raspdif_client_t* raspdif_client_open()
+{
+  int32_t fd = shm_open(RASPDIF_SHM_NAME, O_RDWR, 0);
+  if (fd == -1)
+    return NULL;
+
+  // Only one producer may write to the ring
+  if (flock(fd, LOCK_EX | LOCK_NB) == -1)
+  {
+    close(fd);
+    errno = EBUSY;
+    return NULL;
+  }
+
+  void* data = mmap(NULL, sizeof(raspdif_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  raspdif_shm_t* shm = data;
+  if (atomic_load(&shm->magic) != RASPDIF_SHM_MAGIC || shm->version != RASPDIF_SHM_VERSION || shm->size != RASPDIF_SHM_RING_SIZE)
+  {
+    munmap(data, sizeof(raspdif_shm_t));
+    close(fd);
+    errno = EPROTO;
+    return NULL;
+  }
+
+  raspdif_client_t* client = malloc(sizeof(raspdif_client_t));
+  if (client == NULL)
+  {
+    munmap(data, sizeof(raspdif_shm_t));
+    close(fd);
+    return NULL;
+  }
+
+  client->fd = fd;
+  client->shm = shm;
+  client->generation = atomic_load(&shm->generation) ^ 1; // Never matches so the first sync loads the format
+  client->write_generation = client->generation;
+  client->frame_size = raspdif_client_format_frame_size(shm->format);
+  client->tail = atomic_load(&shm->tail);
+  client->consumed = 0;
+  client->played = 0;
+
+  return client;
+}
+
+/**
+  @brief  Detach from the shared memory ring
+
+  @param  client Client handle
+  @retval none
+*/
+void raspdif_client_close(raspdif_client_t* client)
+{
+  if (client == NULL)
+    return;
+
+  munmap(client->shm, sizeof(raspdif_shm_t));
+  close(client->fd); // Releases lock
+  free(client);
+}
+
+/**
+  @brief  Get the sample rate expected by the daemon
+
+  @param  client Client handle
+  @retval uint32_t - Sample rate in Hz
+*/
+uint32_t raspdif_client_rate(const raspdif_client_t* client)
+{
+  return client->shm->rate;
+}
+
+/**
+  @brief  Get the size of a stereo frame in the format expected by the daemon
+
+  @param  client Client handle
+  @retval uint8_t - Frame size in bytes
+*/
+uint8_t raspdif_client_frame_size(const raspdif_client_t* client)
+{
+  return raspdif_client_format_frame_size(client->shm->format);
+}
+
+/**
+  @brief  Check if the daemon expects S24_LE samples packed in 3 bytes. Otherwise S16_LE
+
+  @param  client Client handle
+  @retval bool
+*/
+bool raspdif_client_is_s24le(const raspdif_client_t* client)
+{
+  return client->shm->format == raspdif_shm_format_s24le;
+}
+
+/**
+  @brief  Get the number of frames that can be written without blocking
+
+  @param  client Client handle
+  @retval size_t - Free frames
+*/
+size_t raspdif_client_avail(const raspdif_client_t* client)
+{
+  uint32_t head = atomic_load_explicit(&client->shm->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&client->shm->tail, memory_order_acquire);
+
+  // Keep a byte free to distinguish full from empty
+  return (tail + RASPDIF_SHM_RING_SIZE - head - 1) % RASPDIF_SHM_RING_SIZE / raspdif_client_frame_size(client);
+}
+
+/**
+  @brief  Get the number of frames written but not yet consumed by the daemon
+
+  @param  client Client handle
+  @retval size_t - Queued frames
+*/
+size_t raspdif_client_queued(const raspdif_client_t* client)
+{
+  uint32_t head = atomic_load_explicit(&client->shm->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&client->shm->tail, memory_order_acquire);
+
+  return (head + RASPDIF_SHM_RING_SIZE - tail) % RASPDIF_SHM_RING_SIZE / raspdif_client_frame_size(client);
+}
+
+/**
+  @brief  Get the number of frames consumed by the daemon since the client was opened.
+          Must be called at least once per ring's worth of frames
+
+  @param  client Client handle
+  @retval uint64_t - Consumed frames
+*/
+uint64_t raspdif_client_consumed(raspdif_client_t* client)
+{
+  if (!raspdif_client_sync(client))
+    return client->consumed;
+
+  uint32_t tail = atomic_load_explicit(&client->shm->tail, memory_order_acquire);
+
+  client->consumed += (tail + RASPDIF_SHM_RING_SIZE - client->tail) % RASPDIF_SHM_RING_SIZE / client->frame_size;
+  client->tail = tail;
+
+  return client->consumed;
+}
+
+/**
+  @brief  Get the number of frames consumed from the ring which the DMA hasn't transmitted yet
+
+  @param  client Client handle
+  @retval size_t - Pending frames
+*/
+static size_t raspdif_client_pending(const raspdif_client_t* client)
+{
+  raspdif_shm_t* shm = client->shm;
+
+  uint32_t sequence = 0;
+  uint32_t frames = 0;
+  uint32_t time = 0;
+  do
+  {
+    sequence = atomic_load(&shm->delay_sequence);
+    frames = atomic_load(&shm->delay_frames);
+    time = atomic_load(&shm->delay_time);
+  } while ((sequence & 1) || sequence != atomic_load(&shm->delay_sequence));
+
+  // Account for frames transmitted since the daemon measured
+  uint64_t elapsed = (uint32_t)(raspdif_shm_time_us() - time);
+  uint64_t transmitted = elapsed * shm->rate / 1000000;
+
+  return (transmitted < frames) ? frames - transmitted : 0;
+}
+
+/**
+  @brief  Get the number of frames written which have not been transmitted yet.
+          Includes frames in the ring and frames the daemon has queued for DMA
+
+  @param  client Client handle
+  @retval size_t - Delay in frames
+*/
+size_t raspdif_client_delay(const raspdif_client_t* client)
+{
+  return raspdif_client_queued(client) + raspdif_client_pending(client);
+}
+
+/**
+  @brief  Get the number of frames transmitted by the DMA since the client was opened.
+          Must be called at least once per ring's worth of frames
+
+  @param  client Client handle
+  @retval uint64_t - Transmitted frames
+*/
+uint64_t raspdif_client_played(raspdif_client_t* client)
+{
+  uint64_t consumed = raspdif_client_consumed(client);
+  size_t pending = raspdif_client_pending(client);
+
+  // Delay and tail are published separately, so hold the position rather than step back
+  if (consumed > pending)
+    client->played = MAX(client->played, consumed - pending);
+
+  return client->played;
+}
+
+/**
+  @brief  Get a pointer to contiguous free space in the ring to write frames directly.
+          Frames must be written in the format read from the daemon at this call
+
+  @param  client Client handle
+  @param  frames Pointer to free space
+  @retval size_t - Number of frames that may be written before commit. 0 while the daemon is switching format or rate
+*/
+size_t raspdif_client_begin(raspdif_client_t* client, void** frames)
+{
+  uint32_t head = atomic_load_explicit(&client->shm->head, memory_order_relaxed);
+
+  *frames = &client->shm->ring[head];
+
+  if (!raspdif_client_sync(client))
+    return 0;
+
+  client->write_generation = client->generation;
+
+  // Limit to end of ring
+  return MIN(raspdif_client_avail(client), (RASPDIF_SHM_RING_SIZE - head) / client->frame_size);
+}
+
+/**
+  @brief  Publish frames written after raspdif_client_begin to the daemon
+
+  @param  client Client handle
+  @param  count Number of frames written
+  @retval bool - Frames were published. False if the daemon switched format or rate since begin and dropped them
+*/
+bool raspdif_client_commit(raspdif_client_t* client, size_t count)
+{
+  raspdif_shm_t* shm = client->shm;
+
+  // Daemon waits for the flag to clear before resetting the ring, so a head checked against the generation lands first
+  atomic_store(&shm->producer_committing, 1);
+  if (atomic_load(&shm->generation) != client->write_generation)
+  {
+    atomic_store(&shm->producer_committing, 0);
+    return false;
+  }
+
+  uint32_t head = atomic_load_explicit(&shm->head, memory_order_relaxed);
+  atomic_store(&shm->head, (head + count * client->frame_size) % RASPDIF_SHM_RING_SIZE);
+  atomic_store(&shm->producer_committing, 0);
+
+  // Wake the daemon if it's waiting on data
+  if (atomic_load(&shm->consumer_waiting))
+  {
+    atomic_fetch_add(&shm->consumer_wake, 1);
+    raspdif_shm_futex_wake(&shm->consumer_wake);
+  }
+
+  return true;
+}
+
+/**
+  @brief  Block until the requested number of frames can be written
+
+  @param  client Client handle
+  @param  count Number of free frames to wait for
+  @param  timeout_ms Maximum time to wait in milliseconds. Negative to wait forever
+  @retval bool - Space is available
+*/
+bool raspdif_client_wait(raspdif_client_t* client, size_t count, int32_t timeout_ms)
+{
+  raspdif_shm_t* shm = client->shm;
+
+  struct timespec timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (timeout_ms % 1000) * 1000000;
+
+  while (raspdif_client_avail(client) < count)
+  {
+    uint32_t tail = atomic_load(&shm->tail);
+
+    // Recheck after flagging so a consume can't be missed
+    atomic_store(&shm->producer_waiting, 1);
+    if (raspdif_client_avail(client) < count)
+    {
+      int32_t result = raspdif_shm_futex_wait(&shm->tail, tail, timeout_ms < 0 ? NULL : &timeout);
+      if (result == -1 && errno == ETIMEDOUT)
+      {
+        atomic_store(&shm->producer_waiting, 0);
+        return false;
+      }
+    }
+
+    atomic_store(&shm->producer_waiting, 0);
+  }
+
+  return true;
+}
+
+/**
+  @brief  Copy frames into the ring. Stops early if the daemon switches format or rate.
+          Producers which must never publish frames packed for an old format
+          should pack in place between raspdif_client_begin and raspdif_client_commit
+
+  @param  client Client handle
+  @param  frames Packed frames in the format expected by the daemon
+  @param  count Number of frames to write
+  @param  block Wait for space until all frames are written
+  @retval size_t - Number of frames written
+*/
+size_t raspdif_client_write(raspdif_client_t* client, const void* frames, size_t count, bool block)
+{
+  const uint8_t* source = frames;
+  size_t written = 0;
+
+  // Frames are packed in the format current at the call
+  if (!raspdif_client_sync(client))
+    return 0;
+
+  uint32_t generation = client->generation;
+
+  while (written < count)
+  {
+    void* destination = NULL;
+    size_t space = raspdif_client_begin(client, &destination);
+    if (atomic_load(&client->shm->generation) != generation)
+      break;
+
+    if (space == 0)
+    {
+      if (!block)
+        break;
+
+      raspdif_client_wait(client, 1, -1);
+      continue;
+    }
+
+    size_t chunk = MIN(space, count - written);
+    memcpy(destination, &source[written * client->frame_size], chunk * client->frame_size);
+    if (!raspdif_client_commit(client, chunk))
+      break;
+
+    written += chunk;
+  }
+
+  return written;
+}
@@ -0,0 +1,34 @@
+#ifndef __RASPDIF_CLIENT__
+#define __RASPDIF_CLIENT__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+  @brief  Client library for writing samples to the raspdif shared memory ring.
+          Only a single client may be attached at a time
+*/
+
+typedef struct raspdif_client_t raspdif_client_t;
+
+raspdif_client_t* raspdif_client_open(void);
+void raspdif_client_close(raspdif_client_t* client);
+
+uint32_t raspdif_client_rate(const raspdif_client_t* client);
+uint8_t raspdif_client_frame_size(const raspdif_client_t* client);
+bool raspdif_client_is_s24le(const raspdif_client_t* client);
+
+size_t raspdif_client_avail(const raspdif_client_t* client);
+size_t raspdif_client_queued(const raspdif_client_t* client);
+uint64_t raspdif_client_consumed(raspdif_client_t* client);
+size_t raspdif_client_delay(const raspdif_client_t* client);
+uint64_t raspdif_client_played(raspdif_client_t* client);
+
+size_t raspdif_client_begin(raspdif_client_t* client, void** frames);
+bool raspdif_client_commit(raspdif_client_t* client, size_t count);
+
+bool raspdif_client_wait(raspdif_client_t* client, size_t count, int32_t timeout_ms);
+size_t raspdif_client_write(raspdif_client_t* client, const void* frames, size_t count, bool block);
+
+#endif
@@ -114,5 +114,6 @@ void bcm283x_clock_init(void* base);
 void bcm283x_clock_configure(clock_peripheral_t peripheral, const clock_configuration_t* config);
 void bcm283x_clock_wait_busy(clock_peripheral_t peripheral);
 void bcm283x_clock_enable(clock_peripheral_t peripheral, bool enable);
+void bcm283x_clock_set_divisor(clock_peripheral_t peripheral, uint16_t divi, uint16_t divf);
 
 #endif
\ No newline at end of file
@@ -250,6 +250,12 @@ void bcm283x_dma_init(void* base);
 void bcm283x_dma_reset(dma_channel_t channel);
 void bcm283x_dma_set_control_block(dma_channel_t channel, const dma_control_block_t* control);
 const dma_control_block_t* bcm283x_dma_get_control_block(dma_channel_t channel);
+const dma_control_block_t* bcm283x_dma_get_next_control_block(dma_channel_t channel);
+void bcm283x_dma_set_next_control_block(dma_channel_t channel, const dma_control_block_t* control);
+dma_transfer_length_t bcm283x_dma_get_transfer_length(dma_channel_t channel);
+dma_transfer_information_t bcm283x_dma_get_transfer_information(dma_channel_t channel);
 void bcm283x_dma_enable(dma_channel_t channel, bool enable);
 bool bcm283x_dma_active(dma_channel_t channel);
+bool bcm283x_dma_is_lite(dma_channel_t channel);
+dma_debug_t bcm283x_dma_check_errors(dma_channel_t channel);
 #endif
\ No newline at end of file
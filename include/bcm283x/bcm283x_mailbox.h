@@ -33,12 +33,29 @@ typedef struct mailbox_message_trailer_t
 typedef enum
 {
   mailbox_tag_id_get_dma_channels = 0x00060001,
+  mailbox_tag_id_get_clock_rate = 0x00030002,
+  mailbox_tag_id_get_max_clock_rate = 0x00030004,
+  mailbox_tag_id_get_min_clock_rate = 0x00030007,
   mailbox_tag_id_allocate_memory = 0x0003000c,
   mailbox_tag_id_lock_memory = 0x0003000d,
   mailbox_tag_id_unlock_memory = 0x0003000e,
   mailbox_tag_id_release_memory = 0x0003000f,
 } mailbox_tag_id_t;
 
+typedef enum
+{
+  mailbox_clock_id_emmc = 1,
+  mailbox_clock_id_uart = 2,
+  mailbox_clock_id_arm = 3,
+  mailbox_clock_id_core = 4,
+  mailbox_clock_id_v3d = 5,
+  mailbox_clock_id_h264 = 6,
+  mailbox_clock_id_isp = 7,
+  mailbox_clock_id_sdram = 8,
+  mailbox_clock_id_pixel = 9,
+  mailbox_clock_id_pwm = 10,
+} mailbox_clock_id_t;
+
 typedef struct mailbox_tag_header_t
 {
   uint32_t identifier;
@@ -68,6 +85,19 @@ typedef struct mailbox_dma_channel_response_t
   mailbox_message_trailer_t trailer;
 } mailbox_dma_channel_response_t;
 
+// Request and response share a layout
+typedef struct mailbox_clock_rate_t
+{
+  mailbox_message_header_t header;
+  struct
+  {
+    mailbox_tag_header_t header;
+    uint32_t clock_id;
+    uint32_t rate; // Hertz
+  } tag;
+  mailbox_message_trailer_t trailer;
+} mailbox_clock_rate_t;
+
 typedef struct mailbox_message_allocate_memory_request_t
 {
   mailbox_message_header_t header;
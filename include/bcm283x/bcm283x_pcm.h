@@ -223,4 +223,5 @@ void bcm283x_pcm_configure(const pcm_configuration_t* config);
 void bcm283x_pcm_configure_transmit_channels(const pcm_channel_config_t* channel1, const pcm_channel_config_t* channel2);
 void bcm283x_pcm_configure_dma(bool enable, const pcm_dma_config_t* config);
 void bcm283x_pcm_enable(bool transmit, bool receive);
+bool bcm283x_pcm_check_transmit_error(void);
 #endif
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef __CLOCK_SOLVER__
+#define __CLOCK_SOLVER__
+
+#include <stdbool.h>
+
+#include "bcm283x_clock.h"
+
+// Rate error in ppm considered as costly as a nanosecond of jitter
+#define CLOCK_SOLVER_PPM_PER_NS 1.0
+
+typedef struct clock_solution_t
+{
+  clock_configuration_t config;
+  double source_hz; // Measured or nominal rate of the selected source
+  bool nominal;     // Source rate couldn't be read so the nominal rate was assumed
+  double divisor;   // Exact divisor for the target rate
+  double rate_hz;   // Rate produced by the configuration
+  double error_ppm;
+  double jitter_ns; // Peak to peak period jitter introduced by the MASH filter
+} clock_solution_t;
+
+bool clock_solver_solve(double target_hz, bool fractional, clock_solution_t* solution);
+const char* clock_solver_source_name(clock_source_t source);
+
+#endif
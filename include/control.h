@@ -0,0 +1,45 @@
+#ifndef __CONTROL__
+#define __CONTROL__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "raspdif.h"
+
+#define CONTROL_DEFAULT_PATH "/run/raspdif.sock"
+#define CONTROL_MESSAGE_SIZE 64
+
+typedef enum control_command_type_t
+{
+  control_command_none,
+  control_command_rate,   // Switch sample rate
+  control_command_format, // Switch sample format
+  control_command_volume, // Set output volume
+} control_command_type_t;
+
+typedef struct control_command_t
+{
+  control_command_type_t type;
+  double rate;
+  raspdif_format_t format;
+  double volume; // Decibels
+
+  // Address of the sender to reply to, if it bound one
+  struct sockaddr_un sender;
+  socklen_t sender_length;
+} control_command_t;
+
+typedef struct control_t
+{
+  int32_t fd; // Datagram socket
+  struct sockaddr_un address;
+} control_t;
+
+bool control_open(control_t* control, const char* path);
+void control_close(control_t* control);
+bool control_receive(control_t* control, control_command_t* command);
+void control_reply(control_t* control, const control_command_t* command, const char* reply);
+
+#endif
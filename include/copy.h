@@ -0,0 +1,48 @@
+#ifndef __COPY__
+#define __COPY__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "bcm283x_dma.h"
+#include "memory.h"
+#include "types.h"
+
+typedef enum copy_status_t
+{
+  copy_status_idle,   // No copy in flight. The last one completed
+  copy_status_busy,   // Copy still in flight
+  copy_status_failed, // Copy faulted or timed out. The channel has been reset
+} copy_status_t;
+
+typedef struct copy_t
+{
+  dma_channel_t channel;
+  memory_physical_t memory; // Control blocks
+  struct
+  {
+    dma_control_block_t* bus;
+    dma_control_block_t* virtual;
+    size_t count;
+  } control;
+  const uint8_t* source; // Locked, page aligned source in virtual memory
+  uintptr32_t* pages;    // Bus address of each page of source
+  size_t page_size;
+  struct
+  {
+    bool active;           // Copy started and not yet seen to complete
+    size_t length;         // Bytes being copied
+    struct timespec start; // CLOCK_MONOTONIC time the copy started
+    uint32_t timeout_us;   // Time after which the copy is abandoned
+  } transfer;
+} copy_t;
+
+bool copy_init(copy_t* copy, dma_channel_t channel, const void* source, size_t length);
+void copy_release(copy_t* copy);
+void copy_start(copy_t* copy, size_t offset, uintptr32_t destination, size_t length);
+copy_status_t copy_poll(copy_t* copy);
+copy_status_t copy_wait(copy_t* copy);
+
+#endif
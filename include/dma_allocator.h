@@ -0,0 +1,15 @@
+#ifndef __DMA_ALLOCATOR__
+#define __DMA_ALLOCATOR__
+
+#include <stdbool.h>
+
+#include "bcm283x_dma.h"
+
+// Lock files coordinate channels between instances of raspdif
+#define DMA_ALLOCATOR_LOCK_PATH "/run/lock/raspdif-dma%d.lock"
+
+void dma_allocator_init(void);
+dma_channel_t dma_allocator_reserve(dma_channel_t preferred, bool full);
+void dma_allocator_release(dma_channel_t channel);
+
+#endif
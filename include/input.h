@@ -0,0 +1,69 @@
+#ifndef __INPUT__
+#define __INPUT__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "raspdif_shm.h"
+
+// Multiple of every frame size so a frame never wraps the end of the ring
+#define INPUT_RING_SIZE (12 * 4096)
+
+// Distance ahead of the consumer that a mapped file is prefetched
+#define INPUT_READAHEAD_SIZE (4 * 1024 * 1024)
+
+typedef enum input_mode_t
+{
+  input_mode_stream, // Reader thread fills the ring from a FIFO or stdin
+  input_mode_map,    // Regular file mapped into memory
+  input_mode_shm,    // Producers write into a shared memory ring
+} input_mode_t;
+
+typedef struct input_t
+{
+  input_mode_t mode;
+  int32_t fd;       // Source file descriptor
+  int32_t data_fd;  // eventfd signaled by the reader when data or EOF is available
+  int32_t space_fd; // eventfd signaled by the consumer when the reader is waiting on space
+  pthread_t thread; // Reader, or shared memory waker
+
+  atomic_size_t head; // Written by reader thread only
+  atomic_size_t tail; // Written by consumer only. Private copy of the shared memory tail
+  atomic_bool eof;
+  atomic_bool reader_waiting;
+  atomic_bool stop; // Asks the shared memory waker to exit
+
+  struct
+  {
+    const uint8_t* data;
+    size_t length;
+    size_t offset;    // Position of consumer
+    size_t readahead; // End of prefetched region
+  } map;
+
+  struct
+  {
+    raspdif_shm_t* data;
+    int32_t fd;
+  } shm;
+
+  uint8_t ring[INPUT_RING_SIZE];
+} input_t;
+
+bool input_open(input_t* input, const char* path);
+bool input_open_shm(input_t* input, raspdif_shm_format_t format, uint32_t rate);
+void input_close(input_t* input);
+int32_t input_get_event_fd(input_t* input);
+size_t input_available(input_t* input);
+size_t input_peek(input_t* input, const uint8_t** data);
+void input_consume(input_t* input, size_t length);
+bool input_eof(input_t* input);
+void input_prepare_wait(input_t* input);
+void input_publish_delay(input_t* input, uint32_t frames);
+void input_reset(input_t* input);
+void input_set_shm_format(input_t* input, raspdif_shm_format_t format, uint32_t rate);
+
+#endif
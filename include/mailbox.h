@@ -14,4 +14,5 @@ uintptr32_t mailbox_lock_memory(uint32_t handle);
 int32_t mailbox_unlock_memory(uint32_t handle);
 int32_t mailbox_release_memory(uint32_t handle);
 uint32_t mailbox_get_dma_channel_mask(void);
+uint32_t mailbox_get_clock_rate(mailbox_tag_id_t tag, mailbox_clock_id_t clock);
 #endif
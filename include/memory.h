@@ -3,10 +3,17 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #include "types.h"
 
+// Bytes moved per iteration of the wide copies
+#define MEMORY_BURST_SIZE 64
+
+typedef void (*memory_copier_t)(void* destination, const void* source, size_t length);
+
 typedef struct pagemap_entry_t
 {
   uint64_t pfn                   : 55;
@@ -28,7 +35,14 @@ static_assert(sizeof(pagemap_entry_t) == sizeof(uint64_t), "pagemap_entry_t must
 
 void* memory_map_physical(off_t offset, size_t length);
 void* memory_allocate_virtual(size_t length);
+off_t memory_virtual_to_physical(const void* virtual);
 memory_physical_t memory_allocate_physical(size_t length);
 int32_t memory_release_physical(const memory_physical_t* memory);
 
+void memory_copy_uncached_scalar(void* destination, const void* source, size_t length);
+void memory_copy_uncached_neon(void* destination, const void* source, size_t length);
+
+void memory_init(void);
+void memory_copy_uncached(void* destination, const void* source, size_t length);
+
 #endif
\ No newline at end of file
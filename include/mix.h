@@ -0,0 +1,39 @@
+#ifndef __MIX__
+#define __MIX__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MIX_UNITY INT32_MAX // Q31 gain of 1.0
+
+// Gain which ramps linearly toward its target to avoid clicks
+typedef struct mix_gain_t
+{
+  int32_t current; // Q31
+  int32_t target;  // Q31
+  int32_t step;    // Magnitude of change per frame
+} mix_gain_t;
+
+// Add stereo frames scaled by a gain which changes by step each frame
+typedef void (*mix_accumulator_t)(int32_t* accumulator, const int32_t* samples, size_t frames, int32_t gain, int32_t step);
+// Scale stereo frames in place by a gain which changes by step each frame
+typedef void (*mix_scaler_t)(int32_t* samples, size_t frames, int32_t gain, int32_t step);
+typedef void (*mix_clamper_t)(int32_t* samples, size_t count, int32_t min, int32_t max);
+
+void mix_accumulate_scalar(int32_t* accumulator, const int32_t* samples, size_t frames, int32_t gain, int32_t step);
+void mix_accumulate_neon(int32_t* accumulator, const int32_t* samples, size_t frames, int32_t gain, int32_t step);
+void mix_scale_scalar(int32_t* samples, size_t frames, int32_t gain, int32_t step);
+void mix_scale_neon(int32_t* samples, size_t frames, int32_t gain, int32_t step);
+void mix_clamp_scalar(int32_t* samples, size_t count, int32_t min, int32_t max);
+void mix_clamp_neon(int32_t* samples, size_t count, int32_t min, int32_t max);
+
+void mix_init(void);
+int32_t mix_gain_from_db(double db);
+void mix_gain_init(mix_gain_t* gain, int32_t value, uint32_t ramp_frames);
+void mix_gain_set(mix_gain_t* gain, int32_t target);
+void mix_gain_set_ramp(mix_gain_t* gain, uint32_t ramp_frames);
+void mix_accumulate(int32_t* accumulator, const int32_t* samples, size_t frames, mix_gain_t* gain);
+void mix_scale(int32_t* samples, size_t frames, mix_gain_t* gain);
+void mix_clamp(int32_t* samples, size_t count, uint8_t bits);
+
+#endif
@@ -3,12 +3,42 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-#define RASPDIF_DEFAULT_SAMPLE_RATE 44.1e3 // 44.1 kHz
-#define RASPDIF_DEFAULT_FORMAT      raspdif_format_s16le
-#define RASPDIF_BUFFER_COUNT        3    // Number of entries in the circular buffer
-#define RASPDIF_BUFFER_SIZE         2048 // Number of samples in each buffer entry. 128 (coded) bits per sample
+#include "bcm283x_dma.h"
+#include "spdif.h"
+
+#define RASPDIF_DEFAULT_SAMPLE_RATE  44.1e3 // 44.1 kHz
+#define RASPDIF_DEFAULT_FORMAT       raspdif_format_s16le
+#define RASPDIF_DEFAULT_BUFFER_COUNT 3    // Number of entries in the circular buffer
+#define RASPDIF_DEFAULT_BUFFER_SIZE  2048 // Number of samples in each buffer entry. 128 (coded) bits per sample
+#define RASPDIF_MIN_BUFFER_COUNT     2
+#define RASPDIF_MAX_BUFFER_COUNT     UINT8_MAX
+#define RASPDIF_MIN_BUFFER_SIZE      64
+#define RASPDIF_MAX_BUFFER_SIZE      (UINT16_MAX / sizeof(spdif_frame_code_t)) // Largest buffer a linear control block can transfer
+#define RASPDIF_MAX_BUFFER_SIZE_2D   262144 // Largest buffer transferred in rows by 2D mode. Full DMA channels only
+#define RASPDIF_MAX_BUFFER_ROWS      16384  // Rows of a 2D transfer representable by YLENGTH
+#define RASPDIF_CHUNK_SIZE           256  // Number of samples parsed and encoded per batch
+#define RASPDIF_NOISE_CACHE_BLOCKS   8    // Number of SPDIF blocks of keep-alive noise to choose a fill from
+#define RASPDIF_IDLE_BLOCKS          16   // Number of SPDIF blocks in the idle loop
+#define RASPDIF_WAKE_MARGIN_US       500  // Delay after predicted DMA completion before waking
+#define RASPDIF_WRITE_AHEAD_US       3000 // Distance ahead of the DMA that audio is written when resuming from idle
+#define RASPDIF_STATS_INTERVAL_S     60   // Period of error statistics
+#define RASPDIF_PCM_FIFO_SIZE        64   // Words in the PCM TX FIFO
+#define RASPDIF_MAX_BURST            16   // Words in the longest DMA burst
+#define RASPDIF_TRIM_INTERVAL_MS     1000 // Period over which the fill level is averaged before trimming the clock
+#define RASPDIF_TRIM_MAX_PPM         1000 // Largest clock correction applied
+#define RASPDIF_TRIM_KP              20.0 // Proportional gain in ppm per millisecond of fill error
+#define RASPDIF_TRIM_KI              1.0  // Integral gain in ppm per millisecond of fill error per interval
+#define RASPDIF_MAX_PENDING_COMMANDS 4    // Commands held until the ring drains
+#define RASPDIF_MAX_INPUTS           8    // Inputs mixed together, including the primary input
+#define RASPDIF_DEFAULT_DUCK_DB      -20  // Attenuation of inputs below the highest active priority
+#define RASPDIF_DUCK_RAMP_MS         50   // Time for a ducking gain to ramp across its full range
+#define RASPDIF_DUCK_HOLD_MS         500  // Time an input keeps ducking others after its audio stops
+#define RASPDIF_VOLUME_RAMP_MS       100  // Time for the volume to ramp across its full range
+
+#define RASPDIF_IDLE_SIZE (RASPDIF_IDLE_BLOCKS * SPDIF_FRAME_COUNT) // Number of samples in the idle buffer
 
 typedef enum raspdif_format_t
 {
@@ -16,26 +46,27 @@ typedef enum raspdif_format_t
   raspdif_format_s24le, // Signed 24 bit little endian
 } raspdif_format_t;
 
-typedef struct raspdif_sample_t
+typedef struct raspdif_idle_buffer_t
 {
-  uint32_t msb;
-  uint32_t lsb;
-} raspdif_sample_t;
+  spdif_frame_code_t sample[RASPDIF_IDLE_SIZE];
+} raspdif_idle_buffer_t;
+static_assert(sizeof(raspdif_idle_buffer_t) <= UINT16_MAX, "Idle buffer must be representable in 16 bits.");
 
-typedef struct raspdif_buffer_t
+typedef struct raspdif_bus_config_t
 {
-  struct
-  {
-    raspdif_sample_t a;
-    raspdif_sample_t b;
-  } sample[RASPDIF_BUFFER_SIZE];
-} raspdif_buffer_t;
-static_assert(sizeof(raspdif_buffer_t) <= UINT16_MAX, "SPDIF buffer must be representable in 16 bits.");
+  uint8_t threshold; // PCM FIFO level below which DMA is requested
+  uint8_t panic;     // PCM FIFO level below which DMA requests are raised to panic priority
+  uint8_t burst;     // Words written to the PCM FIFO per DMA burst
+} raspdif_bus_config_t;
 
+// Ring is sized at runtime. A control block per buffer follows the idle loop, then the buffers themselves
 typedef struct raspdif_control_t
 {
-  dma_control_block_t control_blocks[RASPDIF_BUFFER_COUNT];
-  raspdif_buffer_t buffers[RASPDIF_BUFFER_COUNT];
+  dma_control_block_t idle_lead_in; // Plays the idle buffer from the frame phase where the ring was left
+  dma_control_block_t idle_loop;    // Repeats the entire idle buffer until data returns
+  raspdif_idle_buffer_t idle;
+  dma_control_block_t control_blocks[];
 } raspdif_control_t;
+static_assert(offsetof(raspdif_control_t, control_blocks) % sizeof(dma_control_block_t) == 0, "Control blocks must be 32 byte aligned.");
 
 #endif
\ No newline at end of file
@@ -0,0 +1,104 @@
+#ifndef __RASPDIF_SHM__
+#define __RASPDIF_SHM__
+
+#include <assert.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+  @brief  Shared memory ring used by producers to send samples to the daemon.
+          Shared by the daemon and the client library
+*/
+
+#define RASPDIF_SHM_NAME    "/raspdif"
+#define RASPDIF_SHM_MAGIC   0x46445053 // SPDF
+#define RASPDIF_SHM_VERSION 4
+
+// Multiple of every frame size so a frame never wraps the end of the ring
+#define RASPDIF_SHM_RING_SIZE (12 * 16384)
+
+typedef enum raspdif_shm_format_t
+{
+  raspdif_shm_format_s16le, // Signed 16 bit little endian
+  raspdif_shm_format_s24le, // Signed 24 bit little endian
+} raspdif_shm_format_t;
+
+typedef struct raspdif_shm_t
+{
+  atomic_uint magic; // Written last by the daemon once the ring is ready
+  uint32_t version;
+  uint32_t size;   // Size of ring in bytes
+  uint32_t format; // raspdif_shm_format_t expected by the daemon
+  uint32_t rate;   // Sample rate expected by the daemon in Hz
+
+  // Bumped by the daemon before and after each format or rate switch. Odd while switching
+  atomic_uint generation;
+  // Set by the producer while publishing a commit so a switch can wait for it to land
+  atomic_uint producer_committing;
+
+  // Ring offsets. A byte is kept free to distinguish full from empty
+  atomic_uint head; // Written by producer only, except when the daemon resets the ring on a format switch
+  atomic_uint tail; // Written by daemon only. A copy of the daemon's private offset
+
+  // Set while a side is waiting so the other side only wakes when necessary
+  atomic_uint consumer_waiting;
+  atomic_uint producer_waiting;
+
+  // Futex word the daemon waits on. Bumped before every wake so none can be lost
+  atomic_uint consumer_wake;
+
+  // Frames consumed from the ring but not yet transmitted, measured from the DMA position
+  // Sequence is odd while the daemon is updating
+  atomic_uint delay_sequence;
+  atomic_uint delay_frames;
+  atomic_uint delay_time; // CLOCK_MONOTONIC time of measurement in microseconds
+
+  uint8_t _reserved[4];
+  uint8_t ring[RASPDIF_SHM_RING_SIZE];
+} raspdif_shm_t;
+
+static_assert(RASPDIF_SHM_RING_SIZE % 4 == 0 && RASPDIF_SHM_RING_SIZE % 6 == 0, "Ring must be a multiple of all frame sizes.");
+
+/**
+  @brief  Get the current CLOCK_MONOTONIC time in microseconds. Wraps every ~71 minutes
+
+  @param  none
+  @retval uint32_t
+*/
+static inline uint32_t raspdif_shm_time_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint32_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+  @brief  Wait on a shared futex while it holds the expected value
+
+  @param  futex Futex word
+  @param  value Expected value
+  @param  timeout Maximum duration to wait. NULL to wait forever
+  @retval int - Result of syscall
+*/
+static inline int raspdif_shm_futex_wait(atomic_uint* futex, uint32_t value, const struct timespec* timeout)
+{
+  return syscall(SYS_futex, futex, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+/**
+  @brief  Wake all waiters on a shared futex
+
+  @param  futex Futex word
+  @retval int - Result of syscall
+*/
+static inline int raspdif_shm_futex_wake(atomic_uint* futex)
+{
+  return syscall(SYS_futex, futex, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+#endif
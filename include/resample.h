@@ -0,0 +1,45 @@
+#ifndef __RESAMPLE__
+#define __RESAMPLE__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RESAMPLE_MAX_PHASES 1024 // Largest interpolation factor. Limits the supported rate ratios
+#define RESAMPLE_MAX_RATIO  8    // Largest ratio of output to input rate
+#define RESAMPLE_CHUNK_SIZE 256  // Largest number of frames processed per call
+#define RESAMPLE_COEFF_BITS 30   // Coefficients are Q2.30
+
+typedef enum resample_quality_t
+{
+  resample_quality_low,    // 16 taps per phase
+  resample_quality_medium, // 32 taps per phase
+  resample_quality_high,   // 64 taps per phase
+} resample_quality_t;
+
+// Filter a stereo output frame from one phase of coefficients and each channel's history
+typedef void (*resample_filter_t)(const int32_t* coefficients, const int32_t* left, const int32_t* right, size_t taps, int64_t* output);
+
+typedef struct resample_t
+{
+  uint32_t up;           // Interpolation factor
+  uint32_t down;         // Decimation factor
+  uint16_t taps;         // Coefficients per phase. Multiple of 4
+  int32_t* coefficients; // Time reversed coefficients of each phase
+  int32_t* history[2];   // Deinterleaved input of each channel
+  size_t fill;           // Samples in each channel's history
+  size_t position;       // Start of the window of the next output in the history
+  uint32_t phase;        // Phase of the next output
+  int32_t min;           // Output is clamped to the range of the sample depth
+  int32_t max;
+} resample_t;
+
+void resample_filter_scalar(const int32_t* coefficients, const int32_t* left, const int32_t* right, size_t taps, int64_t* output);
+void resample_filter_neon(const int32_t* coefficients, const int32_t* left, const int32_t* right, size_t taps, int64_t* output);
+
+void resample_select(void);
+bool resample_init(resample_t* resample, uint32_t input_rate, uint32_t output_rate, resample_quality_t quality, uint8_t bits);
+void resample_release(resample_t* resample);
+size_t resample_process(resample_t* resample, const int32_t* input, size_t count, int32_t* output);
+
+#endif
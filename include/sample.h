@@ -0,0 +1,18 @@
+#ifndef __SAMPLE__
+#define __SAMPLE__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*sample_unpacker_t)(const uint8_t* data, int32_t* samples, size_t count);
+
+void sample_unpack_s16le_scalar(const uint8_t* data, int32_t* samples, size_t count);
+void sample_unpack_s24le_scalar(const uint8_t* data, int32_t* samples, size_t count);
+void sample_unpack_s16le_neon(const uint8_t* data, int32_t* samples, size_t count);
+void sample_unpack_s24le_neon(const uint8_t* data, int32_t* samples, size_t count);
+
+void sample_init(void);
+void sample_unpack_s16le(const uint8_t* data, int32_t* samples, size_t count);
+void sample_unpack_s24le(const uint8_t* data, int32_t* samples, size_t count);
+
+#endif
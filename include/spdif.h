@@ -3,6 +3,7 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define SPDIF_FRAME_COUNT 192
@@ -40,13 +41,13 @@ typedef union spdif_pcm_channel_status_t
     uint8_t channel_number : 4; // 1 - Left channel, 2 - Right chanel
 
     // Byte 3
-    uint8_t sample_frequency : 4; // 0 - 44.1 kHz, 1 - Not indicated
+    uint8_t sample_frequency : 4; // 0 - 44.1 kHz, 1 - Not indicated, 2 - 48 kHz, 3 - 32 kHz ... 14 - 192 kHz
     uint8_t clock_accuracy   : 2;
     uint8_t _reserved        : 2;
 
     // Byte 4
-    uint8_t word_length                 : 1; // 0 - 20 bit max sample length
-    uint8_t sample_word_length          : 3; // 0 - Not indicated 1 - 16 bits
+    uint8_t word_length                 : 1; // 0 - 20 bit max sample length, 1 - 24 bit
+    uint8_t sample_word_length          : 3; // 0 - Not indicated 1 - 16 bits, 5 - Max sample length
     uint8_t original_sampling_frequency : 4; // 0 not indicated
 
     uint8_t _reserved2[19];
@@ -78,9 +79,24 @@ typedef struct spdif_frame_t
 typedef struct spdif_block_t
 {
   spdif_frame_t frames[SPDIF_FRAME_COUNT];
+  uint32_t templates[SPDIF_FRAME_COUNT][2]; // BMC encoder data words with only the fixed bits set
 } spdif_block_t;
 
-uint64_t spdif_build_subframe(spdif_subframe_t* subframe, spdif_preamble_t preamble, spdif_sample_depth_t depth, int32_t sample);
-void spdif_populate_channel_status(spdif_block_t* block);
+typedef struct spdif_subframe_code_t
+{
+  uint32_t msb;
+  uint32_t lsb;
+} spdif_subframe_code_t;
+
+typedef struct spdif_frame_code_t
+{
+  spdif_subframe_code_t a;
+  spdif_subframe_code_t b;
+} spdif_frame_code_t;
+static_assert(sizeof(spdif_frame_code_t) == 2 * sizeof(spdif_subframe_code_t), "spdif_frame_code_t must be 2 consecutive subframe codes.");
+
+void spdif_init(const char* encoder);
+uint8_t spdif_encode_frames(const spdif_block_t* block, uint8_t frame_index, spdif_sample_depth_t depth, const int32_t* samples, size_t count, spdif_frame_code_t* codes);
+void spdif_populate_channel_status(spdif_block_t* block, double sample_rate, spdif_sample_depth_t depth);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef __SPDIF_BMC__
+#define __SPDIF_BMC__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "spdif.h"
+
+// Data words are bit reversed subframes with the preamble type in the top nibble
+#define SPDIF_BMC_PREAMBLE_SHIFT 28
+
+extern const uint8_t spdif_bmc_lut_nibble[16];
+extern const uint8_t spdif_bmc_lut_preamble[16];
+
+typedef void (*spdif_bmc_encoder_t)(const uint32_t* data, spdif_subframe_code_t* codes, size_t count);
+
+typedef struct spdif_bmc_backend_t
+{
+  const char* name;
+  spdif_bmc_encoder_t encode;
+  bool (*init)(void); // Prepare lookup tables. Returns false if unsupported by this CPU
+} spdif_bmc_backend_t;
+
+void spdif_bmc_encode_nibble(const uint32_t* data, spdif_subframe_code_t* codes, size_t count);
+void spdif_bmc_encode_byte(const uint32_t* data, spdif_subframe_code_t* codes, size_t count);
+void spdif_bmc_encode_halfword(const uint32_t* data, spdif_subframe_code_t* codes, size_t count);
+void spdif_bmc_encode_neon(const uint32_t* data, spdif_subframe_code_t* codes, size_t count);
+
+const spdif_bmc_backend_t* spdif_bmc_find(const char* name);
+const spdif_bmc_backend_t* spdif_bmc_autotune(void);
+
+#endif
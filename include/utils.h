@@ -2,9 +2,19 @@
 #define __UTILS__
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
 
+#if defined(__arm__)
+#include <sys/auxv.h>
+#endif
+
+// NEON kernels are built for all ARM targets and selected at runtime with neon_supported()
+#if defined(__arm__) || defined(__aarch64__)
+#define RASPDIF_NEON
+#endif
+
 static inline void microsleep(uint32_t microseconds)
 {
   assert(microseconds < 1e6);
@@ -16,4 +26,21 @@ static inline void microsleep(uint32_t microseconds)
   nanosleep(&delay, NULL);
 }
 
+/**
+  @brief  Check if the CPU supports NEON instructions
+
+  @param  none
+  @retval bool
+*/
+static inline bool neon_supported()
+{
+#if defined(__aarch64__)
+  return true; // Mandatory on ARMv8
+#elif defined(__arm__)
+  return getauxval(AT_HWCAP) & HWCAP_ARM_NEON;
+#else
+  return false;
+#endif
+}
+
 #endif
\ No newline at end of file
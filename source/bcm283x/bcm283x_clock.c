@@ -154,4 +154,32 @@ void bcm283x_clock_configure(clock_peripheral_t peripheral, const clock_configur
   // Write to device
   clock->CTL = control;
   clock->DIV = divisor;
-}
\ No newline at end of file
+}
+
+/**
+  @brief  Update the divisor of a running peripheral clock without stopping it.
+          The MASH filter picks up the new divisor at the end of its current
+          cycle so small fractional changes don't glitch the output
+
+  @param  peripheral Target peripheral clock to update
+  @param  divi Integer part of divisor
+  @param  divf Fractional part of divisor in 1/4096ths
+  @retval void
+*/
+void bcm283x_clock_set_divisor(clock_peripheral_t peripheral, uint16_t divi, uint16_t divf)
+{
+  assert(divi > 0 && divi < 4096);
+  assert(divf < 4096);
+
+  bcm283x_clock_t* clock = bcm283x_clock_get_peripheral_clock(peripheral);
+
+  assert(clock != NULL);
+
+  clock_divisor_t divisor = (clock_divisor_t){0};
+  divisor.PASSWD = CLOCK_MANAGER_PASSWORD;
+  divisor.DIVI = divi;
+  divisor.DIVF = divf;
+
+  WMB();
+  clock->DIV = divisor;
+}
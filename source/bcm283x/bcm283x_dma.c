@@ -94,6 +94,77 @@ const dma_control_block_t* bcm283x_dma_get_control_block(dma_channel_t channel)
   return control;
 }
 
+/**
+  @brief  Get the next control block loaded by the selected DMA channel
+
+  @param  channel DMA channel number
+  @retval dma_control_block_t* - Bus address of next control block
+*/
+const dma_control_block_t* bcm283x_dma_get_next_control_block(dma_channel_t channel)
+{
+  bcm283x_dma_channel_t* handle = bcm283x_dma_get_channel(channel);
+
+  const dma_control_block_t* control = (const dma_control_block_t*)(uintptr_t)handle->NEXTCONBK;
+
+  RMB();
+
+  return control;
+}
+
+/**
+  @brief  Set the control block loaded when the active one completes.
+          The channel must be paused while NEXTCONBK is written
+
+  @param  channel DMA channel number
+  @param  control DMA control block to load next
+  @retval void
+*/
+void bcm283x_dma_set_next_control_block(dma_channel_t channel, const dma_control_block_t* control)
+{
+  // Ensure block is 256 bit aligned
+  assert(((uintptr_t)control & 0x1F) == 0);
+
+  bcm283x_dma_channel_t* handle = bcm283x_dma_get_channel(channel);
+
+  WMB();
+
+  handle->NEXTCONBK = PTR32_CAST(control);
+}
+
+/**
+  @brief  Get the remaining transfer length of the active control block
+
+  @param  channel DMA channel number
+  @retval dma_transfer_length_t - Remaining transfer length
+*/
+dma_transfer_length_t bcm283x_dma_get_transfer_length(dma_channel_t channel)
+{
+  bcm283x_dma_channel_t* handle = bcm283x_dma_get_channel(channel);
+
+  dma_transfer_length_t length = handle->TXFR_LEN;
+
+  RMB();
+
+  return length;
+}
+
+/**
+  @brief  Get the transfer information of the active control block of the selected DMA channel
+
+  @param  channel DMA channel number
+  @retval dma_transfer_information_t
+*/
+dma_transfer_information_t bcm283x_dma_get_transfer_information(dma_channel_t channel)
+{
+  bcm283x_dma_channel_t* handle = bcm283x_dma_get_channel(channel);
+
+  dma_transfer_information_t information = handle->TI;
+
+  RMB();
+
+  return information;
+}
+
 /**
   @brief  Enable/disable select DMA channel
 
@@ -125,4 +196,48 @@ bool bcm283x_dma_active(dma_channel_t channel)
   RMB();
 
   return active;
+}
+
+/**
+  @brief  Test if the selected DMA channel is a lite channel. Lite channels
+          have reduced bandwidth and don't support 2D mode
+
+  @param  channel DMA channel number
+  @retval bool
+*/
+bool bcm283x_dma_is_lite(dma_channel_t channel)
+{
+  bcm283x_dma_channel_t* handle = bcm283x_dma_get_channel(channel);
+
+  bool lite = handle->DEBUG.LITE;
+
+  RMB();
+
+  return lite;
+}
+
+/**
+  @brief  Read and clear the error flags of the selected DMA channel
+
+  @param  channel DMA channel number
+  @retval dma_debug_t - Debug register before the errors were cleared
+*/
+dma_debug_t bcm283x_dma_check_errors(dma_channel_t channel)
+{
+  bcm283x_dma_channel_t* handle = bcm283x_dma_get_channel(channel);
+
+  dma_debug_t debug = handle->DEBUG;
+
+  RMB();
+
+  if (debug.READ_ERROR || debug.FIFO_ERROR || debug.READ_LAST_NOT_SET_ERROR)
+  {
+    WMB();
+
+    handle->DEBUG.READ_ERROR = debug.READ_ERROR;
+    handle->DEBUG.FIFO_ERROR = debug.FIFO_ERROR;
+    handle->DEBUG.READ_LAST_NOT_SET_ERROR = debug.READ_LAST_NOT_SET_ERROR;
+  }
+
+  return debug;
 }
\ No newline at end of file
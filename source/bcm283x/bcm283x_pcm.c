@@ -118,6 +118,30 @@ void bcm283x_pcm_clear_fifos()
   bcm283x_pcm_sync();
 }
 
+/**
+  @brief  Check and clear the transmit FIFO error flag. The flag is set when
+          the FIFO underflows
+
+  @param  none
+  @retval bool - FIFO underflowed since the last check
+*/
+bool bcm283x_pcm_check_transmit_error()
+{
+  assert(pcm != NULL);
+
+  bool error = pcm->CS_A.TXERR;
+
+  RMB();
+
+  if (error)
+  {
+    WMB();
+    pcm->CS_A.TXERR = 1;
+  }
+
+  return error;
+}
+
 /**
   @brief  Configure the PCM DMA settings
 
@@ -0,0 +1,274 @@
+#include <assert.h>
+#include <bcm_host.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "clock_solver.h"
+#include "log.h"
+#include "mailbox.h"
+
+#define TAG "Clock"
+
+// Rates of the clock tree as seen by the kernel
+#define CLOCK_SOLVER_RATE_PATH "/sys/kernel/debug/clk/%s/clk_rate"
+
+static const clock_source_t clock_solver_sources[] = {
+  clock_source_oscillator,
+  clock_source_plla,
+  clock_source_pllc,
+  clock_source_plld,
+  clock_source_hdmi_aux,
+};
+
+/**
+  @brief  Get a printable name of a clock source
+
+  @param  source Clock source
+  @retval const char*
+*/
+const char* clock_solver_source_name(clock_source_t source)
+{
+  switch (source)
+  {
+    case clock_source_ground:
+      return "GND";
+
+    case clock_source_oscillator:
+      return "oscillator";
+
+    case clock_source_plla:
+      return "PLLA";
+
+    case clock_source_pllc:
+      return "PLLC";
+
+    case clock_source_plld:
+      return "PLLD";
+
+    case clock_source_hdmi_aux:
+      return "HDMI aux";
+
+    default:
+      return "unknown";
+  }
+}
+
+/**
+  @brief  Read the rate of a clock source from the kernel's clock tree, falling
+          back to the nominal rate of fixed sources
+
+  @param  source Clock source to query
+  @param  fallback Set if the nominal rate was used
+  @retval double - Rate in Hertz. 0 if unknown
+*/
+static double clock_solver_source_rate(clock_source_t source, bool* fallback)
+{
+  const char* name = NULL;
+  double nominal = 0;
+  *fallback = false;
+  switch (source)
+  {
+    case clock_source_oscillator:
+      name = "osc";
+      nominal = bcm_host_is_model_pi4() ? 54e6 : 19.2e6;
+      break;
+
+    case clock_source_plla:
+      name = "plla_per";
+      break;
+
+    case clock_source_pllc:
+      name = "pllc_per";
+      break;
+
+    case clock_source_plld:
+      name = "plld_per";
+      nominal = bcm_host_is_model_pi4() ? 750e6 : 500e6;
+      break;
+
+    case clock_source_hdmi_aux:
+      name = "pllh_aux";
+      break;
+
+    default:
+      return 0;
+  }
+
+  char path[64];
+  snprintf(path, sizeof(path), CLOCK_SOLVER_RATE_PATH, name);
+
+  unsigned long rate = 0;
+  FILE* file = fopen(path, "r");
+  if (file != NULL)
+  {
+    if (fscanf(file, "%lu", &rate) != 1)
+      rate = 0;
+
+    fclose(file);
+  }
+
+  if (rate > 0)
+    return rate;
+
+  // Firmware may have moved the source, so the resulting rate error is unverified
+  if (nominal > 0)
+  {
+    LOGW(TAG, "Couldn't read the rate of %s from %s. Assuming nominal %g Hz.", clock_solver_source_name(source), path, nominal);
+    *fallback = true;
+  }
+
+  return nominal;
+}
+
+/**
+  @brief  Check if a clock source holds its rate while we run
+
+  @param  source Clock source to check
+  @retval bool
+*/
+static bool clock_solver_source_stable(clock_source_t source)
+{
+  switch (source)
+  {
+    case clock_source_oscillator:
+    case clock_source_plld:
+      return true;
+
+    case clock_source_pllc:
+    {
+      // PLLC drives the core clock, which moves with frequency scaling
+      uint32_t min = mailbox_get_clock_rate(mailbox_tag_id_get_min_clock_rate, mailbox_clock_id_core);
+      uint32_t max = mailbox_get_clock_rate(mailbox_tag_id_get_max_clock_rate, mailbox_clock_id_core);
+      LOGD(TAG, "Core clock range %u - %u Hz.", min, max);
+
+      return min != 0 && min == max;
+    }
+
+    default:
+      // Retuned by the firmware for video and display modes
+      return false;
+  }
+}
+
+/**
+  @brief  Find the divisor of a source and MASH filter closest to a target rate
+
+  @param  source_hz Rate of the clock source
+  @param  target_hz Target rate
+  @param  mash MASH filter
+  @param  candidate Configuration to fill
+  @retval bool - Source and filter can produce the target rate
+*/
+static bool clock_solver_evaluate(double source_hz, double target_hz, clock_mash_filter_t mash, clock_solution_t* candidate)
+{
+  // The filter swings DIVI across a range, so it needs headroom below
+  static const uint16_t min_divi[] = {1, 2, 3, 5};
+
+  // Source cycles between the shortest and longest output periods
+  static const uint8_t spread[] = {0, 1, 3, 7};
+
+  double divisor = source_hz / target_hz;
+
+  double divi = 0;
+  double divf = 0;
+  if (mash == clock_mash_filter_none)
+    divi = round(divisor); // Fraction is ignored without a filter
+  else
+  {
+    divf = round(4096 * modf(divisor, &divi));
+    if (divf >= 4096)
+    {
+      divi += 1;
+      divf = 0;
+    }
+  }
+
+  if (divi < min_divi[mash] || divi > 4095)
+    return false;
+
+  candidate->config.mash = mash;
+  candidate->config.divi = divi;
+  candidate->config.divf = divf;
+  candidate->source_hz = source_hz;
+  candidate->divisor = divisor;
+  candidate->rate_hz = source_hz / (divi + divf / 4096);
+  candidate->error_ppm = 1e6 * (candidate->rate_hz - target_hz) / target_hz;
+  candidate->jitter_ns = (divf > 0) ? 1e9 * spread[mash] / source_hz : 0;
+
+  return true;
+}
+
+/**
+  @brief  Choose the clock source, MASH filter and divisor with the lowest
+          combination of rate error and jitter
+
+  @param  target_hz Target clock rate
+  @param  fractional Require a MASH filter so the divisor can be trimmed
+  @param  solution Selected configuration
+  @retval bool - A configuration was found
+*/
+bool clock_solver_solve(double target_hz, bool fractional, clock_solution_t* solution)
+{
+  assert(solution != NULL);
+  assert(target_hz > 0);
+
+  clock_solution_t candidates[sizeof(clock_solver_sources) / sizeof(clock_source_t) * 4];
+  size_t count = 0;
+
+  for (size_t i = 0; i < sizeof(clock_solver_sources) / sizeof(clock_source_t); i++)
+  {
+    clock_source_t source = clock_solver_sources[i];
+
+    bool nominal = false;
+    double source_hz = clock_solver_source_rate(source, &nominal);
+    if (source_hz <= 0)
+    {
+      LOGD(TAG, "Skipping %s. Rate unknown.", clock_solver_source_name(source));
+      continue;
+    }
+
+    if (!clock_solver_source_stable(source))
+    {
+      LOGD(TAG, "Skipping %s at %g Hz. Rate may change.", clock_solver_source_name(source), source_hz);
+      continue;
+    }
+
+    for (clock_mash_filter_t mash = clock_mash_filter_none; mash <= clock_mash_filter_3_stage; mash++)
+    {
+      if (fractional && mash == clock_mash_filter_none)
+        continue;
+
+      clock_solution_t* candidate = &candidates[count];
+      memset(candidate, 0, sizeof(clock_solution_t));
+      candidate->config.source = source;
+      candidate->nominal = nominal;
+
+      if (!clock_solver_evaluate(source_hz, target_hz, mash, candidate))
+        continue;
+
+      LOGD(TAG, "%s at %g Hz, MASH %d: DIVI %d, DIVF %d, error %.3f ppm, jitter %.2f ns.", clock_solver_source_name(source), source_hz, mash, candidate->config.divi, candidate->config.divf, candidate->error_ppm, candidate->jitter_ns);
+      count++;
+    }
+  }
+
+  if (count == 0)
+    return false;
+
+  // Weigh error against jitter so an exact rate isn't bought with a slow source
+  const clock_solution_t* best = NULL;
+  double best_cost = INFINITY;
+  for (size_t i = 0; i < count; i++)
+  {
+    double cost = fabs(candidates[i].error_ppm) + CLOCK_SOLVER_PPM_PER_NS * candidates[i].jitter_ns;
+    if (cost < best_cost)
+    {
+      best = &candidates[i];
+      best_cost = cost;
+    }
+  }
+
+  *solution = *best;
+
+  return true;
+}
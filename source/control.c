@@ -0,0 +1,187 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "log.h"
+
+#define TAG "Control"
+
+/**
+  @brief  Create the control socket. Commands are single datagrams of text
+
+  @param  control Control object to initialize
+  @param  path Filesystem path of the socket
+  @retval bool - Socket is ready
+*/
+bool control_open(control_t* control, const char* path)
+{
+  assert(control != NULL);
+  assert(path != NULL);
+
+  memset(control, 0, sizeof(control_t));
+
+  if (strlen(path) >= sizeof(control->address.sun_path))
+  {
+    LOGE(TAG, "Socket path '%s' is too long.", path);
+    return false;
+  }
+
+  control->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (control->fd == -1)
+  {
+    LOGE(TAG, "Failed to create socket. Error: %s.", strerror(errno));
+    return false;
+  }
+
+  control->address.sun_family = AF_UNIX;
+  strcpy(control->address.sun_path, path);
+
+  // Remove a socket left behind by a previous instance
+  unlink(path);
+
+  if (bind(control->fd, (struct sockaddr*)&control->address, sizeof(control->address)) == -1)
+  {
+    LOGE(TAG, "Failed to bind socket '%s'. Error: %s.", path, strerror(errno));
+    close(control->fd);
+    control->fd = -1;
+    return false;
+  }
+
+  LOGI(TAG, "Listening for commands on '%s'.", path);
+
+  return true;
+}
+
+/**
+  @brief  Close and remove the control socket
+
+  @param  control Control object
+  @retval none
+*/
+void control_close(control_t* control)
+{
+  assert(control != NULL);
+
+  if (control->fd == -1)
+    return;
+
+  close(control->fd);
+  unlink(control->address.sun_path);
+
+  control->fd = -1;
+}
+
+/**
+  @brief  Parse a command from text
+
+  @param  message Null terminated command text
+  @param  command Command to fill
+  @retval bool - Command was recognized
+*/
+static bool control_parse(const char* message, control_command_t* command)
+{
+  char name[16];
+  char value[32];
+  if (sscanf(message, "%15s %31s", name, value) != 2)
+    return false;
+
+  if (strcmp(name, "rate") == 0)
+  {
+    char* end = NULL;
+    command->type = control_command_rate;
+    command->rate = strtod(value, &end);
+
+    return *end == '\0' && command->rate > 0;
+  }
+
+  if (strcmp(name, "format") == 0)
+  {
+    command->type = control_command_format;
+    if (strcmp(value, "s16le") == 0)
+      command->format = raspdif_format_s16le;
+    else if (strcmp(value, "s24le") == 0)
+      command->format = raspdif_format_s24le;
+    else
+      return false;
+
+    return true;
+  }
+
+  if (strcmp(name, "volume") == 0)
+  {
+    char* end = NULL;
+    command->type = control_command_volume;
+    command->volume = strtod(value, &end);
+
+    return *end == '\0' && command->volume <= 0;
+  }
+
+  return false;
+}
+
+/**
+  @brief  Receive the next pending command without blocking
+
+  @param  control Control object
+  @param  command Received command
+  @retval bool - A valid command was received
+*/
+bool control_receive(control_t* control, control_command_t* command)
+{
+  assert(control != NULL);
+  assert(command != NULL);
+
+  memset(command, 0, sizeof(control_command_t));
+
+  char message[CONTROL_MESSAGE_SIZE];
+  command->sender_length = sizeof(command->sender);
+
+  ssize_t length = recvfrom(control->fd, message, sizeof(message) - 1, 0, (struct sockaddr*)&command->sender, &command->sender_length);
+  if (length < 0)
+  {
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      LOGE(TAG, "Failed to receive command. Error: %s.", strerror(errno));
+
+    return false;
+  }
+
+  message[length] = '\0';
+  message[strcspn(message, "\r\n")] = '\0';
+
+  if (!control_parse(message, command))
+  {
+    LOGW(TAG, "Invalid command '%s'.", message);
+    control_reply(control, command, "error invalid command");
+    command->type = control_command_none;
+    return false;
+  }
+
+  LOGD(TAG, "Received command '%s'.", message);
+
+  return true;
+}
+
+/**
+  @brief  Reply to the sender of a command if it bound an address
+
+  @param  control Control object
+  @param  command Command being replied to
+  @param  reply Null terminated reply text
+  @retval none
+*/
+void control_reply(control_t* control, const control_command_t* command, const char* reply)
+{
+  assert(control != NULL);
+  assert(command != NULL);
+
+  // Unbound senders have no address beyond the family
+  if (command->sender_length <= offsetof(struct sockaddr_un, sun_path))
+    return;
+
+  if (sendto(control->fd, reply, strlen(reply), MSG_DONTWAIT, (const struct sockaddr*)&command->sender, command->sender_length) == -1)
+    LOGW(TAG, "Failed to send reply. Error: %s.", strerror(errno));
+}
@@ -0,0 +1,266 @@
+#include <assert.h>
+#include <bcm_host.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bcm283x.h"
+#include "copy.h"
+#include "log.h"
+
+#define TAG "Copy"
+
+// Legacy DMA channels can only address the first GB of SDRAM
+#define COPY_MAX_PHYSICAL_ADDRESS 0x40000000
+
+#define COPY_BYTES_PER_US  200  // Typical throughput of a memory to memory DMA copy
+#define COPY_TIMEOUT_SCALE 4    // Multiple of the expected duration before a copy is abandoned
+#define COPY_TIMEOUT_US    1000 // Added to the timeout to cover scheduling delays
+
+/**
+  @brief  Clean a range of the data cache to the point of coherency so the DMA
+          reads the latest data. Only AArch64 allows this from user space
+
+  @param  start Start of range
+  @param  length Length of range in bytes
+  @retval none
+*/
+static void copy_clean_cache(const void* start, size_t length)
+{
+#if defined(__aarch64__)
+  // Smallest data cache line is encoded as log2 of words in CTR_EL0.DminLine
+  uint64_t ctr;
+  __asm__ volatile("mrs %0, ctr_el0" : "=r"(ctr));
+  uintptr_t line = 4 << ((ctr >> 16) & 0xF);
+
+  uintptr_t end = (uintptr_t)start + length;
+  for (uintptr_t address = (uintptr_t)start & ~(line - 1); address < end; address += line)
+    __asm__ volatile("dc cvac, %0" : : "r"(address) : "memory");
+
+  __asm__ volatile("dsb sy" : : : "memory");
+#else
+  (void)start;
+  (void)length;
+#endif
+}
+
+/**
+  @brief  Prepare a DMA channel to copy from cached memory into DMA memory. The
+          source must be locked and page aligned so its bus addresses don't change
+
+  @param  copy Copy object to initialize
+  @param  channel DMA channel to perform copies with
+  @param  source Source memory in virtual space
+  @param  length Length of source in bytes
+  @retval bool - Copies can be performed
+*/
+bool copy_init(copy_t* copy, dma_channel_t channel, const void* source, size_t length)
+{
+  memset(copy, 0, sizeof(copy_t));
+
+#if !defined(__aarch64__)
+  // 32 bit kernels only clean to the point of unification, leaving dirty lines in the L2 the DMA can't see
+  LOGW(TAG, "Data cache can't be cleaned for DMA on 32 bit ARM.");
+  return false;
+#endif
+
+  copy->channel = channel;
+  copy->source = source;
+  copy->page_size = sysconf(_SC_PAGE_SIZE);
+
+  assert(((uintptr_t)source % copy->page_size) == 0);
+
+  // Resolve each page of the source to its bus address
+  size_t page_count = (length + copy->page_size - 1) / copy->page_size;
+  copy->pages = malloc(page_count * sizeof(uintptr32_t));
+  if (copy->pages == NULL)
+    return false;
+
+  for (size_t i = 0; i < page_count; i++)
+  {
+    off_t physical = memory_virtual_to_physical(&copy->source[i * copy->page_size]);
+    if (physical < 0 || physical + copy->page_size > COPY_MAX_PHYSICAL_ADDRESS)
+    {
+      LOGE(TAG, "Page %d of source is not addressable by DMA.", i);
+      free(copy->pages);
+      return false;
+    }
+
+    copy->pages[i] = (uintptr32_t)(physical + bcm_host_get_sdram_address());
+  }
+
+  // Any copy spans at most one more page than the source contains
+  copy->control.count = page_count + 1;
+  size_t control_size = copy->control.count * sizeof(dma_control_block_t);
+
+  copy->memory = memory_allocate_physical(control_size);
+  if (copy->memory.address == PTR32_NULL)
+  {
+    free(copy->pages);
+    return false;
+  }
+
+  uint8_t* bus_base = (uint8_t*)(uintptr_t)copy->memory.address;
+  uint8_t* physical_base = bus_base - bcm_host_get_sdram_address();
+  void* virtual_base = memory_map_physical((off_t)physical_base, control_size);
+  if (virtual_base == NULL)
+  {
+    memory_release_physical(&copy->memory);
+    free(copy->pages);
+    return false;
+  }
+
+  copy->control.bus = (dma_control_block_t*)bus_base;
+  copy->control.virtual = (dma_control_block_t*)virtual_base;
+
+  bcm283x_dma_reset(copy->channel);
+
+  LOGD(TAG, "Copying %d pages with DMA channel %d.", page_count, channel);
+
+  return true;
+}
+
+/**
+  @brief  Stop the copy channel and release its memory
+
+  @param  copy Copy object
+  @retval none
+*/
+void copy_release(copy_t* copy)
+{
+  bcm283x_dma_enable(copy->channel, false);
+
+  memory_release_physical(&copy->memory);
+  free(copy->pages);
+}
+
+/**
+  @brief  Get the microseconds elapsed since a CLOCK_MONOTONIC time
+
+  @param  start Start time
+  @retval uint64_t
+*/
+static uint64_t copy_elapsed_us(const struct timespec* start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/**
+  @brief  Start copying a range of the source into DMA memory. A control block
+          is chained for each source page the range touches. The source range
+          must not be written until copy_poll or copy_wait reports completion
+
+  @param  copy Copy object. Any previous copy must have completed
+  @param  offset Offset of range within source in bytes
+  @param  destination Bus address to copy to
+  @param  length Length of range in bytes
+  @retval none
+*/
+void copy_start(copy_t* copy, size_t offset, uintptr32_t destination, size_t length)
+{
+  assert(!copy->transfer.active);
+
+  if (length == 0)
+    return;
+
+  copy->transfer.length = length;
+  copy->transfer.timeout_us = COPY_TIMEOUT_SCALE * (length / COPY_BYTES_PER_US) + COPY_TIMEOUT_US;
+
+  // Write the range back to memory so the DMA sees the latest data
+  copy_clean_cache(&copy->source[offset], length);
+
+  size_t index = 0;
+  while (length > 0)
+  {
+    assert(index < copy->control.count);
+
+    size_t page = offset / copy->page_size;
+    size_t chunk = MIN(length, copy->page_size - (offset % copy->page_size));
+
+    dma_control_block_t* control = &copy->control.virtual[index];
+    memset(control, 0, sizeof(dma_control_block_t));
+
+    control->transfer_information.SRC_INC = 1;
+    control->transfer_information.DEST_INC = 1;
+    control->transfer_information.WAIT_RESP = 1;
+    control->transfer_information.PERMAP = DMA_DREQ_ALWAYS_ON;
+
+    control->source_address = copy->pages[page] + (offset % copy->page_size);
+    control->destination_address = destination;
+    control->transfer_length.XLENGTH = chunk;
+
+    offset += chunk;
+    destination += chunk;
+    length -= chunk;
+
+    // Chain to the next block, or stop after the last
+    control->next_control_block = (length > 0) ? PTR32_CAST(&copy->control.bus[index + 1]) : PTR32_NULL;
+    index++;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &copy->transfer.start);
+
+  bcm283x_dma_set_control_block(copy->channel, copy->control.bus);
+  bcm283x_dma_enable(copy->channel, true);
+
+  copy->transfer.active = true;
+}
+
+/**
+  @brief  Check on the copy in flight without blocking
+
+  @param  copy Copy object
+  @retval copy_status_t - The channel is reset if the copy failed or timed out
+*/
+copy_status_t copy_poll(copy_t* copy)
+{
+  if (!copy->transfer.active)
+    return copy_status_idle;
+
+  dma_debug_t debug = bcm283x_dma_check_errors(copy->channel);
+  if (debug.READ_ERROR || debug.FIFO_ERROR || debug.READ_LAST_NOT_SET_ERROR)
+  {
+    LOGE(TAG, "DMA copy failed. Read: %d, FIFO: %d, Read last not set: %d.", debug.READ_ERROR, debug.FIFO_ERROR, debug.READ_LAST_NOT_SET_ERROR);
+    bcm283x_dma_reset(copy->channel);
+    copy->transfer.active = false;
+    return copy_status_failed;
+  }
+
+  // Channel goes inactive once the last block completes or an error halts it
+  if (!bcm283x_dma_active(copy->channel))
+  {
+    copy->transfer.active = false;
+    return copy_status_idle;
+  }
+
+  if (copy_elapsed_us(&copy->transfer.start) > copy->transfer.timeout_us)
+  {
+    LOGE(TAG, "DMA copy of %zu bytes timed out after %u us.", copy->transfer.length, copy->transfer.timeout_us);
+    bcm283x_dma_reset(copy->channel);
+    copy->transfer.active = false;
+    return copy_status_failed;
+  }
+
+  return copy_status_busy;
+}
+
+/**
+  @brief  Block until the copy in flight completes. Copies normally finish while
+          the caller waits on input or the DMA, so this rarely has to spin
+
+  @param  copy Copy object
+  @retval copy_status_t - copy_status_idle or copy_status_failed
+*/
+copy_status_t copy_wait(copy_t* copy)
+{
+  copy_status_t status = copy_poll(copy);
+  while (status == copy_status_busy)
+    status = copy_poll(copy);
+
+  return status;
+}
@@ -0,0 +1,176 @@
+#include <bcm_host.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "bcm283x.h"
+#include "dma_allocator.h"
+#include "log.h"
+#include "mailbox.h"
+
+#define TAG "DMA"
+
+static struct
+{
+  uint32_t mask;                  // Channels the firmware allows the ARM to use
+  int32_t locks[dma_channel_max]; // Lock file of each reserved channel, -1 if free
+} allocator;
+
+/**
+  @brief  Open and lock the lock file of a channel without blocking
+
+  @param  channel DMA channel number
+  @retval int32_t - Locked file descriptor. -1 if locked by another instance or on error
+*/
+static int32_t dma_allocator_lock(dma_channel_t channel)
+{
+  char path[64];
+  snprintf(path, sizeof(path), DMA_ALLOCATOR_LOCK_PATH, channel);
+
+  int32_t fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1)
+  {
+    LOGE(TAG, "Failed to open '%s'. Error: %s", path, strerror(errno));
+    return -1;
+  }
+
+  if (flock(fd, LOCK_EX | LOCK_NB) == -1)
+  {
+    LOGD(TAG, "DMA channel %d is locked by another instance.", channel);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/**
+  @brief  Reset a channel left feeding the PCM by an instance that was killed.
+          Such a channel is active but no longer locked
+
+  @param  channel DMA channel number
+  @retval none
+*/
+static void dma_allocator_reset_stale(dma_channel_t channel)
+{
+  if (!bcm283x_dma_active(channel) || bcm283x_dma_get_transfer_information(channel).PERMAP != DMA_DREQ_PCM_TX)
+    return;
+
+  int32_t fd = dma_allocator_lock(channel);
+  if (fd == -1)
+    return;
+
+  LOGW(TAG, "Resetting DMA channel %d left running by a previous instance.", channel);
+  bcm283x_dma_reset(channel);
+
+  close(fd);
+}
+
+/**
+  @brief  Read the usable channels from the firmware and reset any left
+          running by a previous instance. Must be called after the DMA
+          peripheral is initialized
+
+  @param  none
+  @retval none
+*/
+void dma_allocator_init()
+{
+  for (dma_channel_t channel = dma_channel_0; channel < dma_channel_max; channel++)
+    allocator.locks[channel] = -1;
+
+  allocator.mask = mailbox_get_dma_channel_mask();
+  if (allocator.mask == UINT32_MAX)
+  {
+    LOGW(TAG, "Failed to read DMA channel mask from firmware.");
+    allocator.mask = 0;
+  }
+
+  // Channels 11 to 14 of the BCM2711 are DMA4 engines with a different register layout
+  if (bcm_host_is_model_pi4())
+    allocator.mask &= (1 << dma_channel_11) - 1;
+
+  LOGD(TAG, "Usable DMA channel mask 0x%04X.", allocator.mask);
+
+  // A second channel feeding the PCM FIFO would corrupt the output
+  for (dma_channel_t channel = dma_channel_0; channel < dma_channel_max; channel++)
+  {
+    if (allocator.mask & (1 << channel))
+      dma_allocator_reset_stale(channel);
+  }
+}
+
+/**
+  @brief  Try to claim a channel. The channel must be idle and not locked by another instance
+
+  @param  channel DMA channel number
+  @param  full Channel must be a full channel rather than a lite one
+  @retval bool - Channel was claimed
+*/
+static bool dma_allocator_claim(dma_channel_t channel, bool full)
+{
+  if (allocator.locks[channel] != -1)
+    return false;
+
+  if (bcm283x_dma_active(channel))
+  {
+    LOGD(TAG, "DMA channel %d is active.", channel);
+    return false;
+  }
+
+  if (full && bcm283x_dma_is_lite(channel))
+    return false;
+
+  int32_t fd = dma_allocator_lock(channel);
+  if (fd == -1)
+    return false;
+
+  allocator.locks[channel] = fd;
+
+  return true;
+}
+
+/**
+  @brief  Reserve a DMA channel for the lifetime of the process
+
+  @param  preferred Channel to reserve. dma_channel_max to select the highest free channel
+  @param  full Channel must be a full channel rather than a lite one
+  @retval dma_channel_t - Reserved channel. dma_channel_max if none are free
+*/
+dma_channel_t dma_allocator_reserve(dma_channel_t preferred, bool full)
+{
+  if (preferred != dma_channel_max)
+  {
+    if (!(allocator.mask & (1 << preferred)))
+      LOGW(TAG, "DMA channel %d is not reserved for the ARM by firmware.", preferred);
+
+    return dma_allocator_claim(preferred, full) ? preferred : dma_channel_max;
+  }
+
+  // Lower channels are more likely to be claimed by kernel drivers
+  for (int32_t channel = dma_channel_max - 1; channel >= dma_channel_0; channel--)
+  {
+    if ((allocator.mask & (1 << channel)) && dma_allocator_claim(channel, full))
+      return channel;
+  }
+
+  return dma_channel_max;
+}
+
+/**
+  @brief  Release a reserved DMA channel
+
+  @param  channel DMA channel number
+  @retval none
+*/
+void dma_allocator_release(dma_channel_t channel)
+{
+  if (channel >= dma_channel_max || allocator.locks[channel] == -1)
+    return;
+
+  close(allocator.locks[channel]);
+  allocator.locks[channel] = -1;
+}
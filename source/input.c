@@ -0,0 +1,708 @@
+#define _GNU_SOURCE // pthread_setname_np
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "log.h"
+
+#define TAG "Input"
+
+#define INPUT_SHM_COMMIT_TIMEOUT_US 100000 // Longest a switch waits for a producer to finish a commit
+
+/**
+  @brief  Block until the eventfd is signaled and reset it
+
+  @param  fd eventfd to wait on
+  @retval none
+*/
+static void input_wait_event(int32_t fd)
+{
+  struct pollfd poll_list;
+  poll_list.fd = fd;
+  poll_list.events = POLLIN;
+  poll(&poll_list, 1, -1);
+
+  eventfd_t value;
+  eventfd_read(fd, &value);
+}
+
+/**
+  @brief  Get the number of bytes that can be written before the ring is full
+
+  @param  input Input object
+  @param  head Current head of ring
+  @retval size_t - Contiguous free space
+*/
+static size_t input_free(input_t* input, size_t head)
+{
+  size_t tail = atomic_load(&input->tail);
+
+  // Keep a byte free to distinguish full from empty
+  if (head >= tail)
+    return INPUT_RING_SIZE - head - (tail == 0 ? 1 : 0);
+
+  return tail - head - 1;
+}
+
+/**
+  @brief  Reader thread. Reads large chunks from the source into the ring
+
+  @param  arg Input object
+  @retval void*
+*/
+static void* input_reader(void* arg)
+{
+  input_t* input = arg;
+
+  while (true)
+  {
+    size_t head = atomic_load_explicit(&input->head, memory_order_relaxed);
+
+    size_t space = input_free(input, head);
+    if (space == 0)
+    {
+      // Recheck after flagging so a consume can't be missed
+      atomic_store(&input->reader_waiting, true);
+      if (input_free(input, head) == 0)
+        input_wait_event(input->space_fd);
+
+      atomic_store(&input->reader_waiting, false);
+      continue;
+    }
+
+    ssize_t result = read(input->fd, &input->ring[head], space);
+    if (result < 0 && errno == EINTR)
+      continue;
+
+    if (result <= 0)
+    {
+      if (result < 0)
+        LOGE(TAG, "Failed to read input. Error: %s.", strerror(errno));
+
+      atomic_store(&input->eof, true);
+      eventfd_write(input->data_fd, 1);
+      break;
+    }
+
+    // Publish data to the consumer
+    atomic_store_explicit(&input->head, (head + result) % INPUT_RING_SIZE, memory_order_release);
+    eventfd_write(input->data_fd, 1);
+  }
+
+  return NULL;
+}
+
+/**
+  @brief  Prefetch the mapped file ahead of the consumer
+
+  @param  input Input object
+  @retval none
+*/
+static void input_map_readahead(input_t* input)
+{
+  // Wait until half the window is consumed before requesting more
+  if (input->map.readahead >= input->map.length || input->map.readahead > input->map.offset + INPUT_READAHEAD_SIZE / 2)
+    return;
+
+  // Page align start of request
+  size_t start = input->map.readahead & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+  size_t end = MIN(input->map.offset + INPUT_READAHEAD_SIZE, input->map.length);
+
+  madvise((void*)&input->map.data[start], end - start, MADV_WILLNEED);
+  input->map.readahead = end;
+}
+
+/**
+  @brief  Map a regular file into memory so the encoder can read it without copying
+
+  @param  input Input object to initialize
+  @param  path Path of file to map
+  @retval bool - Input was mapped
+*/
+static bool input_open_map(input_t* input, const char* path)
+{
+  input->fd = open(path, O_RDONLY);
+  if (input->fd == -1)
+  {
+    LOGE(TAG, "Unable to open file. Error: %s.", strerror(errno));
+    return false;
+  }
+
+  struct stat info;
+  if (fstat(input->fd, &info) == -1)
+  {
+    LOGE(TAG, "Failed to stat file. Error: %s.", strerror(errno));
+    close(input->fd);
+    input->fd = -1;
+    return false;
+  }
+
+  input->mode = input_mode_map;
+  input->map.data = NULL;
+  input->map.length = info.st_size;
+  input->map.offset = 0;
+  input->map.readahead = 0;
+
+  // Entire file is available immediately
+  atomic_store(&input->eof, true);
+
+  if (input->map.length == 0)
+    return true;
+
+  void* data = mmap(NULL, input->map.length, PROT_READ, MAP_PRIVATE, input->fd, 0);
+  if (data == MAP_FAILED)
+  {
+    LOGE(TAG, "Failed to map file of length %zu. Error: %s.", input->map.length, strerror(errno));
+    close(input->fd);
+    input->fd = -1;
+    return false;
+  }
+
+  input->map.data = data;
+  madvise(data, input->map.length, MADV_SEQUENTIAL);
+  input_map_readahead(input);
+
+  LOGD(TAG, "Mapped %zu byte file.", input->map.length);
+
+  return true;
+}
+
+/**
+  @brief  Shared memory waker thread. Converts producer futex wakeups into
+          eventfd signals for the consumer
+
+  @param  arg Input object
+  @retval void*
+*/
+static void* input_shm_waker(void* arg)
+{
+  input_t* input = arg;
+  raspdif_shm_t* shm = input->shm.data;
+
+  uint32_t wake = atomic_load(&shm->consumer_wake);
+  while (!atomic_load(&input->stop))
+  {
+    // Word is bumped before every wake, so one sent before the wait returns immediately
+    raspdif_shm_futex_wait(&shm->consumer_wake, wake, NULL);
+    wake = atomic_load(&shm->consumer_wake);
+
+    // Signal the consumer once per sleep
+    if (atomic_exchange(&shm->consumer_waiting, 0))
+      eventfd_write(input->data_fd, 1);
+  }
+
+  return NULL;
+}
+
+/**
+  @brief  Get the producer's head offset, rejecting values outside the ring.
+          An invalid head ends the input
+
+  @param  input Input object
+  @param  head Head offset
+  @retval bool - Head is valid
+*/
+static bool input_shm_head(input_t* input, uint32_t* head)
+{
+  *head = atomic_load_explicit(&input->shm.data->head, memory_order_acquire);
+  if (*head < RASPDIF_SHM_RING_SIZE)
+    return true;
+
+  if (!atomic_exchange(&input->eof, true))
+  {
+    LOGE(TAG, "Producer wrote invalid ring offset %u. Closing shared memory input.", *head);
+    eventfd_write(input->data_fd, 1);
+  }
+
+  return false;
+}
+
+/**
+  @brief  Create the shared memory ring and start the waker thread
+
+  @param  input Input object to initialize
+  @param  format Sample format producers must write
+  @param  rate Sample rate producers must write
+  @retval bool - Ring was created
+*/
+bool input_open_shm(input_t* input, raspdif_shm_format_t format, uint32_t rate)
+{
+  input->mode = input_mode_shm;
+  input->fd = -1;
+  atomic_init(&input->tail, 0);
+  atomic_init(&input->eof, false);
+  atomic_init(&input->stop, false);
+
+  input->data_fd = eventfd(0, 0);
+  input->space_fd = -1;
+  if (input->data_fd == -1)
+  {
+    LOGE(TAG, "Failed to create eventfd. Error: %s.", strerror(errno));
+    return false;
+  }
+
+  input->shm.fd = shm_open(RASPDIF_SHM_NAME, O_CREAT | O_RDWR, 0666);
+  if (input->shm.fd == -1)
+  {
+    LOGE(TAG, "Failed to open shared memory. Error: %s.", strerror(errno));
+    close(input->data_fd);
+    return false;
+  }
+
+  // Allow unprivileged producers regardless of umask
+  fchmod(input->shm.fd, 0666);
+
+  if (ftruncate(input->shm.fd, sizeof(raspdif_shm_t)) == -1)
+  {
+    LOGE(TAG, "Failed to size shared memory. Error: %s.", strerror(errno));
+    close(input->shm.fd);
+    close(input->data_fd);
+    return false;
+  }
+
+  void* data = mmap(NULL, sizeof(raspdif_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, input->shm.fd, 0);
+  if (data == MAP_FAILED)
+  {
+    LOGE(TAG, "Failed to map shared memory. Error: %s.", strerror(errno));
+    close(input->shm.fd);
+    close(input->data_fd);
+    return false;
+  }
+
+  raspdif_shm_t* shm = data;
+  memset(shm, 0, offsetof(raspdif_shm_t, ring));
+
+  shm->version = RASPDIF_SHM_VERSION;
+  shm->size = RASPDIF_SHM_RING_SIZE;
+  shm->format = format;
+  shm->rate = rate;
+
+  // Publish ring to producers
+  atomic_store(&shm->magic, RASPDIF_SHM_MAGIC);
+  input->shm.data = shm;
+
+  int32_t result = pthread_create(&input->thread, NULL, input_shm_waker, input);
+  if (result != 0)
+  {
+    LOGE(TAG, "Failed to create waker thread. Error: %s.", strerror(result));
+    munmap(shm, sizeof(raspdif_shm_t));
+    close(input->shm.fd);
+    shm_unlink(RASPDIF_SHM_NAME);
+    close(input->data_fd);
+    return false;
+  }
+
+  pthread_setname_np(input->thread, "raspdif-shm");
+
+  LOGI(TAG, "Shared memory ring available at %s.", RASPDIF_SHM_NAME);
+
+  return true;
+}
+
+/**
+  @brief  Close the eventfds of an input which failed to open
+
+  @param  input Input object
+  @retval none
+*/
+static void input_close_events(input_t* input)
+{
+  if (input->data_fd != -1)
+    close(input->data_fd);
+
+  if (input->space_fd != -1)
+    close(input->space_fd);
+
+  input->data_fd = -1;
+  input->space_fd = -1;
+}
+
+/**
+  @brief  Open the input file, or stdin. Regular files are mapped, otherwise
+          the reader thread is started
+
+  @param  input Input object to initialize
+  @param  path Path of file to read. NULL for stdin
+  @retval bool - Input was opened
+*/
+bool input_open(input_t* input, const char* path)
+{
+  atomic_init(&input->head, 0);
+  atomic_init(&input->tail, 0);
+  atomic_init(&input->eof, false);
+  atomic_init(&input->reader_waiting, false);
+
+  input->data_fd = eventfd(0, 0);
+  input->space_fd = eventfd(0, 0);
+  if (input->data_fd == -1 || input->space_fd == -1)
+  {
+    LOGE(TAG, "Failed to create eventfd. Error: %s.", strerror(errno));
+    input_close_events(input);
+    return false;
+  }
+
+  // Regular files are mapped instead of read
+  struct stat info;
+  if (path != NULL && stat(path, &info) == 0 && S_ISREG(info.st_mode))
+  {
+    if (!input_open_map(input, path))
+    {
+      input_close_events(input);
+      return false;
+    }
+
+    eventfd_write(input->data_fd, 1);
+    return true;
+  }
+
+  // Open with writing to prevent EOF when FIFO is empty
+  input->mode = input_mode_stream;
+  input->fd = (path != NULL) ? open(path, O_RDWR) : STDIN_FILENO;
+  if (input->fd == -1)
+  {
+    LOGE(TAG, "Unable to open file. Error: %s.", strerror(errno));
+    input_close_events(input);
+    return false;
+  }
+
+  int32_t result = pthread_create(&input->thread, NULL, input_reader, input);
+  if (result != 0)
+  {
+    LOGE(TAG, "Failed to create reader thread. Error: %s.", strerror(result));
+    if (input->fd != STDIN_FILENO)
+      close(input->fd);
+
+    input->fd = -1;
+    input_close_events(input);
+    return false;
+  }
+
+  pthread_setname_np(input->thread, "raspdif-input");
+
+  return true;
+}
+
+/**
+  @brief  Stop the reader thread and close the input
+
+  @param  input Input object
+  @retval none
+*/
+void input_close(input_t* input)
+{
+  if (input->mode == input_mode_map)
+  {
+    if (input->map.data != NULL)
+      munmap((void*)input->map.data, input->map.length);
+  }
+  else if (input->mode == input_mode_shm)
+  {
+    // Bump the futex word so the stop can't be missed
+    atomic_store(&input->stop, true);
+    atomic_fetch_add(&input->shm.data->consumer_wake, 1);
+    raspdif_shm_futex_wake(&input->shm.data->consumer_wake);
+    pthread_join(input->thread, NULL);
+
+    atomic_store(&input->shm.data->magic, 0);
+    munmap(input->shm.data, sizeof(raspdif_shm_t));
+    close(input->shm.fd);
+    shm_unlink(RASPDIF_SHM_NAME);
+  }
+  else
+  {
+    pthread_cancel(input->thread);
+    pthread_join(input->thread, NULL);
+  }
+
+  close(input->data_fd);
+  if (input->space_fd != -1)
+    close(input->space_fd);
+
+  if (input->fd != -1 && input->fd != STDIN_FILENO)
+    close(input->fd);
+}
+
+/**
+  @brief  Get the eventfd signaled when data or EOF is available
+
+  @param  input Input object
+  @retval int32_t - File descriptor
+*/
+int32_t input_get_event_fd(input_t* input)
+{
+  return input->data_fd;
+}
+
+/**
+  @brief  Get the total number of bytes available to the consumer
+
+  @param  input Input object
+  @retval size_t
+*/
+size_t input_available(input_t* input)
+{
+  if (input->mode == input_mode_map)
+    return input->map.length - input->map.offset;
+
+  if (input->mode == input_mode_shm)
+  {
+    uint32_t head = 0;
+    if (!input_shm_head(input, &head))
+      return 0;
+
+    size_t tail = atomic_load_explicit(&input->tail, memory_order_relaxed);
+
+    return (head + RASPDIF_SHM_RING_SIZE - tail) % RASPDIF_SHM_RING_SIZE;
+  }
+
+  size_t head = atomic_load_explicit(&input->head, memory_order_acquire);
+  size_t tail = atomic_load_explicit(&input->tail, memory_order_relaxed);
+
+  return (head + INPUT_RING_SIZE - tail) % INPUT_RING_SIZE;
+}
+
+/**
+  @brief  Get the contiguous data available to the consumer without copying
+
+  @param  input Input object
+  @param  data Pointer to start of available data
+  @retval size_t - Number of contiguous bytes available
+*/
+size_t input_peek(input_t* input, const uint8_t** data)
+{
+  if (input->mode == input_mode_map)
+  {
+    *data = &input->map.data[input->map.offset];
+    return input->map.length - input->map.offset;
+  }
+
+  if (input->mode == input_mode_shm)
+  {
+    // Only the private tail indexes the ring
+    size_t tail = atomic_load_explicit(&input->tail, memory_order_relaxed);
+    *data = &input->shm.data->ring[tail];
+
+    uint32_t head = 0;
+    if (!input_shm_head(input, &head))
+      return 0;
+
+    return (head >= tail) ? head - tail : RASPDIF_SHM_RING_SIZE - tail;
+  }
+
+  size_t head = atomic_load_explicit(&input->head, memory_order_acquire);
+  size_t tail = atomic_load_explicit(&input->tail, memory_order_relaxed);
+
+  *data = &input->ring[tail];
+
+  return (head >= tail) ? head - tail : INPUT_RING_SIZE - tail;
+}
+
+/**
+  @brief  Release data returned by input_peek back to the reader or producer
+
+  @param  input Input object
+  @param  length Number of bytes consumed
+  @retval none
+*/
+void input_consume(input_t* input, size_t length)
+{
+  assert(length <= input_available(input));
+
+  if (input->mode == input_mode_map)
+  {
+    input->map.offset += length;
+    input_map_readahead(input);
+    return;
+  }
+
+  if (input->mode == input_mode_shm)
+  {
+    raspdif_shm_t* shm = input->shm.data;
+
+    // Producers only see a copy of the tail
+    size_t tail = (atomic_load_explicit(&input->tail, memory_order_relaxed) + length) % RASPDIF_SHM_RING_SIZE;
+    atomic_store(&input->tail, tail);
+    atomic_store(&shm->tail, tail);
+
+    // Wake the producer if it's waiting on space
+    if (atomic_load(&shm->producer_waiting))
+      raspdif_shm_futex_wake(&shm->tail);
+    return;
+  }
+
+  size_t tail = atomic_load_explicit(&input->tail, memory_order_relaxed);
+  atomic_store(&input->tail, (tail + length) % INPUT_RING_SIZE);
+
+  // Wake the reader if it's waiting on space
+  if (atomic_load(&input->reader_waiting))
+    eventfd_write(input->space_fd, 1);
+}
+
+/**
+  @brief  Arm the shared memory wakeup before the consumer sleeps. Producers
+          only wake the daemon while it's armed and the ring is empty
+
+  @param  input Input object
+  @retval none
+*/
+void input_prepare_wait(input_t* input)
+{
+  if (input->mode != input_mode_shm)
+    return;
+
+  // Recheck after arming so a commit made before it can't be missed
+  atomic_store(&input->shm.data->consumer_waiting, 1);
+  if (input_available(input) > 0)
+    atomic_store(&input->shm.data->consumer_waiting, 0);
+}
+
+/**
+  @brief  Publish the number of frames consumed but not yet transmitted to shared memory producers
+
+  @param  input Input object
+  @param  frames Frames queued in DMA buffers
+  @retval none
+*/
+void input_publish_delay(input_t* input, uint32_t frames)
+{
+  if (input->mode != input_mode_shm)
+    return;
+
+  raspdif_shm_t* shm = input->shm.data;
+
+  // Odd sequence marks update in progress
+  uint32_t sequence = atomic_load_explicit(&shm->delay_sequence, memory_order_relaxed);
+  atomic_store(&shm->delay_sequence, sequence + 1);
+
+  atomic_store(&shm->delay_frames, frames);
+  atomic_store(&shm->delay_time, raspdif_shm_time_us());
+
+  atomic_store(&shm->delay_sequence, sequence + 2);
+}
+
+/**
+  @brief  Check if the reader has reached the end of the stream. Data may remain in the ring
+
+  @param  input Input object
+  @retval bool
+*/
+bool input_eof(input_t* input)
+{
+  return atomic_load(&input->eof);
+}
+
+/**
+  @brief  Discard buffered data and restart the ring at offset 0, so frames of a
+          new size never straddle its end. Producers must be idle, as they are
+          while a format switch is applied
+
+  @param  input Input object
+  @retval none
+*/
+void input_reset(input_t* input)
+{
+  assert(input != NULL);
+
+  // Mapped files are contiguous
+  if (input->mode == input_mode_map)
+    return;
+
+  // Producers must be fenced off while the shared memory ring is reset. See input_set_shm_format
+  if (input->mode == input_mode_shm)
+    return;
+
+  // Reader holds the old head while blocked, so restart it once the offsets are reset
+  pthread_cancel(input->thread);
+  pthread_join(input->thread, NULL);
+
+  atomic_store(&input->head, 0);
+  atomic_store(&input->tail, 0);
+  atomic_store(&input->reader_waiting, false);
+
+  if (atomic_load(&input->eof))
+    return;
+
+  int32_t result = pthread_create(&input->thread, NULL, input_reader, input);
+  if (result != 0)
+  {
+    LOGE(TAG, "Failed to restart reader thread. Error: %s.", strerror(result));
+    atomic_store(&input->eof, true);
+    eventfd_write(input->data_fd, 1);
+    return;
+  }
+
+  pthread_setname_np(input->thread, "raspdif-input");
+}
+
+/**
+  @brief  Wait for a commit the producer is publishing to land
+
+  @param  shm Shared memory ring
+  @retval none
+*/
+static void input_shm_wait_commit(raspdif_shm_t* shm)
+{
+  // A commit is a few stores, so only a producer that died mid-commit holds the flag for long
+  uint32_t start = raspdif_shm_time_us();
+  while (atomic_load(&shm->producer_committing))
+  {
+    if ((uint32_t)(raspdif_shm_time_us() - start) > INPUT_SHM_COMMIT_TIMEOUT_US)
+    {
+      LOGW(TAG, "Producer didn't finish its commit. Switching anyway.");
+      atomic_store(&shm->producer_committing, 0);
+      return;
+    }
+
+    sched_yield();
+  }
+}
+
+/**
+  @brief  Update the format and rate advertised to producers in the shared memory ring.
+          The ring is restarted at offset 0 when the frame size changes
+
+  @param  input Input object
+  @param  format Sample format producers must write
+  @param  rate Sample rate producers must write
+  @retval none
+*/
+void input_set_shm_format(input_t* input, raspdif_shm_format_t format, uint32_t rate)
+{
+  assert(input != NULL);
+
+  if (input->mode != input_mode_shm)
+    return;
+
+  raspdif_shm_t* shm = input->shm.data;
+
+  // Odd generation stops producers beginning new writes. Commits started under the old one are dropped
+  atomic_fetch_add(&shm->generation, 1);
+  input_shm_wait_commit(shm);
+
+  // Drop any partial frame so frames of the new size never straddle the end of the ring
+  if (format != shm->format)
+  {
+    atomic_store(&input->tail, 0);
+    atomic_store(&shm->tail, 0);
+    atomic_store(&shm->head, 0);
+  }
+
+  shm->format = format;
+  shm->rate = rate;
+
+  atomic_fetch_add(&shm->generation, 1);
+
+  // Wake a producer waiting on space so it sees the switch
+  if (atomic_load(&shm->producer_waiting))
+    raspdif_shm_futex_wake(&shm->tail);
+}
@@ -221,4 +221,41 @@ uint32_t mailbox_get_dma_channel_mask()
   LOGD(TAG, "DMA Channel Mask: 0x%X", response->tag.mask);
 
   return response->tag.mask;
+}
+
+/**
+  @brief  Fetch the current, maximum or minimum rate of a firmware clock
+
+  @param  tag One of the get clock rate tags
+  @param  clock Firmware clock to query
+  @retval uint32_t - Clock rate in Hertz. 0 if error
+*/
+uint32_t mailbox_get_clock_rate(mailbox_tag_id_t tag, mailbox_clock_id_t clock)
+{
+  assert(tag == mailbox_tag_id_get_clock_rate || tag == mailbox_tag_id_get_max_clock_rate || tag == mailbox_tag_id_get_min_clock_rate);
+
+  mailbox_clock_rate_t request;
+  memset(&request, 0, sizeof(mailbox_clock_rate_t));
+
+  request.header.length = sizeof(mailbox_clock_rate_t);
+  request.header.code = 0;
+
+  request.tag.header.identifier = tag;
+  request.tag.header.length = 8;
+  request.tag.header.code = 0;
+
+  request.tag.clock_id = clock;
+
+  request.trailer.end = 0;
+
+  if (mailbox_send(&request) < 0)
+    return 0;
+
+  if ((request.header.code & MAILBOX_CODE_SUCCESS) != MAILBOX_CODE_SUCCESS)
+    return 0;
+
+  if ((request.tag.header.code & MAILBOX_CODE_SUCCESS) != MAILBOX_CODE_SUCCESS)
+    return 0;
+
+  return request.tag.rate;
 }
\ No newline at end of file
@@ -1,18 +1,29 @@
 #include <argp.h>
 #include <bcm_host.h>
-#include <fcntl.h>
 #include <math.h>
-#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/param.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 
 #include "bcm283x.h"
+#include "clock_solver.h"
+#include "control.h"
+#include "copy.h"
+#include "dma_allocator.h"
 #include "git_version.h"
+#include "input.h"
 #include "log.h"
 #include "memory.h"
+#include "mix.h"
 #include "raspdif.h"
+#include "resample.h"
+#include "sample.h"
 #include "spdif.h"
 #include "utils.h"
 
@@ -27,18 +38,150 @@ static struct
     raspdif_control_t* bus;
     raspdif_control_t* virtual;
   } control;
+  struct
+  {
+    uint8_t count; // Number of buffers in the ring
+    uint32_t size; // Number of samples in each buffer
+    uint16_t rows; // Rows each buffer is transferred in. More than 1 uses 2D mode
+  } buffer;
+  struct
+  {
+    uint8_t frame_index;         // Position within SPDIF block
+    uint32_t buffer_offset;      // Number of samples stored in the current buffer
+    spdif_frame_code_t* staging; // Cached buffer samples are encoded into before being committed to DMA memory
+  } encoder;
+  struct
+  {
+    bool enabled; // Staged samples are committed by a second DMA channel
+    copy_t engine;
+    spdif_frame_code_t* buffer; // Buffer of the copy in flight
+    uint32_t offset;            // Index of first sample of the copy in flight
+    size_t count;               // Samples in the copy in flight. 0 when idle
+  } copy;
+  struct
+  {
+    spdif_frame_code_t* silence; // Encoded silence. Entry N is at frame phase N % SPDIF_FRAME_COUNT
+    spdif_frame_code_t* noise;   // Encoded keep-alive noise. Entry N is at frame phase N % SPDIF_FRAME_COUNT
+    size_t silence_size;
+    size_t noise_size;
+  } cache;
+  struct
+  {
+    uint8_t buffer_index; // Buffer which leads into the idle loop
+    bool entered;         // Ring is linked into the idle loop
+    bool exiting;         // Idle loop is linked back to the ring
+    bool write_ahead;     // Encoder is writing into the idle buffer ahead of the DMA
+    bool dirty;           // Idle buffer contains audio and must be rebuilt before reuse
+  } idle;
+  input_t input;
+  struct
+  {
+    int32_t epoll_fd;
+    int32_t timer_fd;  // Armed from predicted DMA progress
+    int32_t signal_fd; // Termination requests
+    bool running;
+  } loop;
+  raspdif_bus_config_t bus;
+  struct
+  {
+    clock_configuration_t config;
+    double divisor;  // Nominal divisor for the sample rate. 0 until configured
+    bool fractional; // Divisor must stay fractional so it can be trimmed
+  } clock;
+  struct
+  {
+    uint8_t count; // Inputs mixed. 0 if only the primary input is read
+    struct
+    {
+      input_t* input;
+      uint8_t priority;
+      uint32_t hold; // Frames this input keeps ducking others after its audio stops
+      mix_gain_t gain;
+    } sources[RASPDIF_MAX_INPUTS];
+    int32_t duck;         // Q31 gain of ducked inputs
+    uint32_t hold_frames; // Frames an input ducks others after its audio stops
+  } mix;
+  struct
+  {
+    bool enabled;
+    mix_gain_t gain; // Applied to every sample before encoding
+  } volume;
+  struct
+  {
+    bool enabled;
+    resample_t engine;
+    resample_quality_t quality;
+    int32_t output[2 * (RESAMPLE_CHUNK_SIZE * RESAMPLE_MAX_RATIO + 1)]; // Resampled frames waiting to be encoded
+    size_t count;
+    size_t offset;
+    bool flushed; // Filter history was played out after the input ended
+  } resample;
+  struct
+  {
+    bool enabled;
+    control_t socket;
+    control_command_t pending[RASPDIF_MAX_PENDING_COMMANDS]; // Applied once the ring drains
+    uint8_t count;
+  } command;
+  struct
+  {
+    bool enabled;
+    uint8_t settle;  // Intervals to discard before capturing the setpoint
+    double setpoint; // Fill level in frames to hold
+    double sum;      // Fill levels observed this interval
+    uint32_t samples;
+    double integral; // Accumulated fill error in milliseconds
+    double ppm;      // Correction currently applied
+    struct timespec start;
+  } trim;
+  struct
+  {
+    bool enabled;
+    int32_t timer_fd;    // Fires every reporting interval
+    uint32_t checks;     // Times the error flags were read this interval
+    uint32_t underflows; // Checks which found the PCM FIFO had underflowed
+    uint32_t dma_errors; // Checks which found DMA errors
+  } stats;
 } raspdif;
 
 typedef struct raspdif_arguments_t
 {
   const char* file;
+  const char* encoder;
   bool verbose;
   bool keep_alive;
   bool pcm_disable;
-  double sample_rate;
+  bool shared_memory;
+  bool dma_copy;
+  dma_channel_t dma_channel;
+  double sample_rate; // Output rate
+  double input_rate;  // Differs from the output rate when resampling
+  double resample_rate;
+  resample_quality_t resample_quality;
   raspdif_format_t format;
+  uint8_t buffer_count;
+  uint32_t buffer_size;
+  raspdif_bus_config_t bus; // Zero fields are replaced by defaults for the sample rate
+  bool stats;
+  bool adaptive;
+  const char* control; // Path of control socket. NULL if disabled
+  const char* mix[RASPDIF_MAX_INPUTS - 1];
+  uint8_t mix_priority[RASPDIF_MAX_INPUTS - 1];
+  uint8_t mix_count;
+  double duck_db;
+  double volume_db;
 } raspdif_arguments_t;
 
+// Keys of options without a short form
+enum
+{
+  OPTION_DREQ_THRESHOLD = 0x100,
+  OPTION_PANIC_THRESHOLD,
+  OPTION_BURST,
+  OPTION_DUCK,
+  OPTION_VOLUME,
+};
+
 const char* argp_program_version = "raspdif " GIT_VERSION;
 const char* argp_program_bug_address = "https://github.com/mill1000/raspdif/issues";
 static struct argp_option options[] = {
@@ -47,6 +190,23 @@ static struct argp_option options[] = {
   {"format", 'f', "FORMAT", 0, "Set audio sample format to s16le or s24le. Default: s16le"},
   {"no-keep-alive", 'k', 0, 0, "Don't send silent noise during underrun."},
   {"disable-pcm-on-idle", 'd', 0, 0, "Disable PCM during underrun."},
+  {"shared-memory", 's', 0, 0, "Receive data from clients via shared memory instead of stdin."},
+  {"buffers", 'b', "COUNT", 0, "Set number of buffers in the DMA ring. Default: 3"},
+  {"period", 'p', "FRAMES", 0, "Set number of frames in each buffer. Default: 2048"},
+  {"dma-copy", 'c', 0, 0, "Commit encoded buffers to DMA memory with a second DMA channel. 64 bit OS only."},
+  {"dma-channel", 'D', "CHANNEL", 0, "Use DMA channel for output. Default: highest free"},
+  {"encoder", 'e', "ENCODER", 0, "Force BMC encoder to nibble, byte, halfword or neon. Default: fastest"},
+  {"dreq-threshold", OPTION_DREQ_THRESHOLD, "WORDS", 0, "Request DMA when the PCM FIFO holds fewer words. Default: by rate"},
+  {"panic-threshold", OPTION_PANIC_THRESHOLD, "WORDS", 0, "Raise DMA to panic priority when the PCM FIFO holds fewer words. Default: by rate"},
+  {"burst", OPTION_BURST, "WORDS", 0, "Set words per DMA burst. Default: by rate"},
+  {"stats", 't', 0, 0, "Log checks that found PCM underflows or DMA errors every minute."},
+  {"adaptive-rate", 'a', 0, 0, "Trim the output clock to follow the rate of a live producer."},
+  {"resample", 'R', "RATE", 0, "Resample input to a fixed output rate."},
+  {"resample-quality", 'Q', "QUALITY", 0, "Set resampling quality to low, medium or high. Default: medium"},
+  {"mix", 'm', "PATH[:PRIORITY]", 0, "Mix another input. Higher priority inputs duck lower ones. Default priority: 0"},
+  {"duck", OPTION_DUCK, "DB", 0, "Attenuate inputs below the highest active priority. Default: -20 dB"},
+  {"volume", OPTION_VOLUME, "DB", 0, "Set initial output volume. Default: 0 dB"},
+  {"control", 'C', "PATH", OPTION_ARG_OPTIONAL, "Accept rate, format and volume changes on a socket. Default: " CONTROL_DEFAULT_PATH},
   {"verbose", 'v', 0, 0, "Enable debug messages."},
   {0},
 };
@@ -81,6 +241,10 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state)
       arguments->file = arg;
       break;
 
+    case 'e':
+      arguments->encoder = arg;
+      break;
+
     case 'r':
       arguments->sample_rate = strtod(arg, NULL);
       break;
@@ -97,6 +261,167 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state)
       arguments->pcm_disable = true;
       break;
 
+    case 's':
+      arguments->shared_memory = true;
+      break;
+
+    case 'c':
+#if !defined(__aarch64__)
+      // Staged samples can only be cleaned from the data cache for the DMA on AArch64
+      LOGF(TAG, "--dma-copy requires a 64 bit OS. The data cache can't be cleaned for DMA on 32 bit ARM.");
+      return EINVAL;
+#else
+      arguments->dma_copy = true;
+      break;
+#endif
+
+    case 'D':
+    {
+      long channel = strtol(arg, NULL, 10);
+      if (channel < dma_channel_0 || channel >= dma_channel_max)
+      {
+        LOGF(TAG, "DMA channel must be between %d and %d.", dma_channel_0, dma_channel_max - 1);
+        return EINVAL;
+      }
+      arguments->dma_channel = channel;
+      break;
+    }
+
+    case OPTION_DREQ_THRESHOLD:
+    case OPTION_PANIC_THRESHOLD:
+    {
+      long words = strtol(arg, NULL, 10);
+      if (words < 1 || words >= RASPDIF_PCM_FIFO_SIZE)
+      {
+        LOGF(TAG, "Thresholds must be between 1 and %d words.", RASPDIF_PCM_FIFO_SIZE - 1);
+        return EINVAL;
+      }
+
+      if (key == OPTION_DREQ_THRESHOLD)
+        arguments->bus.threshold = words;
+      else
+        arguments->bus.panic = words;
+      break;
+    }
+
+    case OPTION_BURST:
+    {
+      long words = strtol(arg, NULL, 10);
+      if (words < 1 || words > RASPDIF_MAX_BURST)
+      {
+        LOGF(TAG, "Burst must be between 1 and %d words.", RASPDIF_MAX_BURST);
+        return EINVAL;
+      }
+      arguments->bus.burst = words;
+      break;
+    }
+
+    case 't':
+      arguments->stats = true;
+      break;
+
+    case 'a':
+      arguments->adaptive = true;
+      break;
+
+    case 'R':
+      arguments->resample_rate = strtod(arg, NULL);
+      if (arguments->resample_rate <= 0)
+      {
+        LOGF(TAG, "Invalid resample rate '%s'", arg);
+        return EINVAL;
+      }
+      break;
+
+    case 'Q':
+      if (strcmp("low", arg) == 0)
+        arguments->resample_quality = resample_quality_low;
+      else if (strcmp("medium", arg) == 0)
+        arguments->resample_quality = resample_quality_medium;
+      else if (strcmp("high", arg) == 0)
+        arguments->resample_quality = resample_quality_high;
+      else
+      {
+        LOGF(TAG, "Unrecognized quality '%s'", arg);
+        return EINVAL;
+      }
+      break;
+
+    case 'm':
+    {
+      if (arguments->mix_count >= RASPDIF_MAX_INPUTS - 1)
+      {
+        LOGF(TAG, "At most %d inputs can be mixed.", RASPDIF_MAX_INPUTS);
+        return EINVAL;
+      }
+
+      // Split off a trailing priority
+      long priority = 0;
+      char* separator = strrchr(arg, ':');
+      if (separator != NULL)
+      {
+        char* end = NULL;
+        priority = strtol(separator + 1, &end, 10);
+        if (*end != '\0' || end == separator + 1 || priority < 0 || priority > UINT8_MAX)
+        {
+          LOGF(TAG, "Invalid priority in '%s'", arg);
+          return EINVAL;
+        }
+        *separator = '\0';
+      }
+
+      arguments->mix[arguments->mix_count] = arg;
+      arguments->mix_priority[arguments->mix_count] = priority;
+      arguments->mix_count++;
+      break;
+    }
+
+    case OPTION_DUCK:
+      arguments->duck_db = strtod(arg, NULL);
+      if (arguments->duck_db > 0)
+      {
+        LOGF(TAG, "Ducking must attenuate.");
+        return EINVAL;
+      }
+      break;
+
+    case OPTION_VOLUME:
+      arguments->volume_db = strtod(arg, NULL);
+      if (arguments->volume_db > 0)
+      {
+        LOGF(TAG, "Volume must not exceed 0 dB.");
+        return EINVAL;
+      }
+      break;
+
+    case 'C':
+      arguments->control = (arg != NULL) ? arg : CONTROL_DEFAULT_PATH;
+      break;
+
+    case 'b':
+    {
+      long count = strtol(arg, NULL, 10);
+      if (count < RASPDIF_MIN_BUFFER_COUNT || count > RASPDIF_MAX_BUFFER_COUNT)
+      {
+        LOGF(TAG, "Buffer count must be between %d and %d.", RASPDIF_MIN_BUFFER_COUNT, RASPDIF_MAX_BUFFER_COUNT);
+        return EINVAL;
+      }
+      arguments->buffer_count = count;
+      break;
+    }
+
+    case 'p':
+    {
+      long size = strtol(arg, NULL, 10);
+      if (size < RASPDIF_MIN_BUFFER_SIZE || size > RASPDIF_MAX_BUFFER_SIZE_2D)
+      {
+        LOGF(TAG, "Period must be between %d and %d frames.", RASPDIF_MIN_BUFFER_SIZE, RASPDIF_MAX_BUFFER_SIZE_2D);
+        return EINVAL;
+      }
+      arguments->buffer_size = size;
+      break;
+    }
+
     default:
       return ARGP_ERR_UNKNOWN;
   }
@@ -117,66 +442,238 @@ void raspdif_shutdown()
   bcm283x_clock_enable(clock_peripheral_pcm, false);
   bcm283x_dma_enable(raspdif.dma_channel, false);
 
+  if (raspdif.copy.enabled)
+  {
+    copy_release(&raspdif.copy.engine);
+    dma_allocator_release(raspdif.copy.engine.channel);
+  }
+
+  dma_allocator_release(raspdif.dma_channel);
+
   // Free allocated memory
   memory_release_physical(&raspdif.memory);
 }
 
 /**
-  @brief  Generate the DMA controls blocks for the code buffers
+  @brief  Get the size of the control structure including the ring of buffers
 
-  @param  b_control raspdif_control_t structure in bus domain
-  @param  v_control raspdif_control_t structure in virtual domain
+  @param  none
+  @retval size_t - Size in bytes
+*/
+static size_t raspdif_control_size()
+{
+  return sizeof(raspdif_control_t) + raspdif.buffer.count * (sizeof(dma_control_block_t) + raspdif.buffer.size * sizeof(spdif_frame_code_t));
+}
+
+/**
+  @brief  Get a buffer of the ring. Buffers follow the last control block
+
+  @param  control raspdif_control_t structure in either domain
+  @param  buffer_index Index of buffer
+  @retval spdif_frame_code_t* - Start of buffer in the same domain as control
+*/
+static spdif_frame_code_t* raspdif_buffer(raspdif_control_t* control, uint8_t buffer_index)
+{
+  spdif_frame_code_t* buffers = (spdif_frame_code_t*)&control->control_blocks[raspdif.buffer.count];
+
+  return &buffers[buffer_index * raspdif.buffer.size];
+}
+
+/**
+  @brief  Convert an address within the control structure to the bus domain
+
+  @param  virtual Address within raspdif.control.virtual
+  @retval uintptr32_t - Bus address
+*/
+static uintptr32_t raspdif_bus_address(const void* virtual)
+{
+  ptrdiff_t offset = (const uint8_t*)virtual - (const uint8_t*)raspdif.control.virtual;
+
+  return PTR32_CAST((uint8_t*)raspdif.control.bus + offset);
+}
+
+/**
+  @brief  Configure a DMA control block to transfer a buffer to the PCM FIFO
+
+  @param  control DMA control block to configure
+  @param  source Bus address of buffer
+  @param  length Length of each row in bytes
+  @param  rows Number of contiguous rows in buffer. More than 1 requires a full DMA channel
+  @param  next Bus address of next control block
   @retval none
 */
-static void raspdif_generate_dma_control_blocks(raspdif_control_t* b_control, raspdif_control_t* v_control)
+static void raspdif_configure_dma_control_block(dma_control_block_t* control, const void* source, uint16_t length, uint16_t rows, const dma_control_block_t* next)
 {
   // Construct references to PCM peripheral at its bus addresses
   bcm283x_pcm_t* b_pcm = (bcm283x_pcm_t*)(BCM283X_BUS_PERIPHERAL_BASE + PCM_BASE_OFFSET);
 
-  // Zero-init all control blocks
-  memset((void*)v_control->control_blocks, 0, RASPDIF_BUFFER_COUNT * sizeof(dma_control_block_t));
+  // PCM FIFO is a single word wide so bursts are of individual words
+  control->transfer_information.NO_WIDE_BURSTS = 1;
+  control->transfer_information.BURST_LENGTH = raspdif.bus.burst - 1;
+  control->transfer_information.PERMAP = DMA_DREQ_PCM_TX;
+  control->transfer_information.DEST_DREQ = 1;
+  control->transfer_information.WAIT_RESP = 1;
+  control->transfer_information.SRC_INC = 1;
 
-  for (size_t i = 0; i < RASPDIF_BUFFER_COUNT; i++)
+  control->source_address = PTR32_CAST(source);
+  control->destination_address = PTR32_CAST(&b_pcm->FIFO_A);
+  control->transfer_length.XLENGTH = length;
+
+  if (rows > 1)
   {
-    // Configure DMA control block for this buffer
-    dma_control_block_t* control = &v_control->control_blocks[i];
+    // 2D mode transfers YLENGTH + 1 rows. Source rows are contiguous and the destination is fixed
+    control->transfer_information.TDMODE = 1;
+    control->transfer_length.YLENGTH = rows - 1;
+    control->stride.S_STRIDE = 0;
+    control->stride.D_STRIDE = 0;
+  }
 
-    control->transfer_information.NO_WIDE_BURSTS = 1;
-    control->transfer_information.PERMAP = DMA_DREQ_PCM_TX;
-    control->transfer_information.DEST_DREQ = 1;
-    control->transfer_information.WAIT_RESP = 1;
-    control->transfer_information.SRC_INC = 1;
+  control->next_control_block = PTR32_CAST(next);
+}
+
+/**
+  @brief  Generate the DMA controls blocks for the code buffers and idle loop
 
-    control->source_address = PTR32_CAST(&b_control->buffers[i]);
-    control->destination_address = PTR32_CAST(&b_pcm->FIFO_A);
-    control->transfer_length.XLENGTH = sizeof(raspdif_buffer_t);
+  @param  b_control raspdif_control_t structure in bus domain
+  @param  v_control raspdif_control_t structure in virtual domain
+  @retval none
+*/
+static void raspdif_generate_dma_control_blocks(raspdif_control_t* b_control, raspdif_control_t* v_control)
+{
+  // Zero-init all control blocks
+  memset((void*)v_control->control_blocks, 0, raspdif.buffer.count * sizeof(dma_control_block_t));
+  memset((void*)&v_control->idle_lead_in, 0, sizeof(dma_control_block_t));
+  memset((void*)&v_control->idle_loop, 0, sizeof(dma_control_block_t));
 
-    // Point to next block, or first if at end
-    control->next_control_block = PTR32_CAST(&b_control->control_blocks[(i + 1) % RASPDIF_BUFFER_COUNT]);
+  for (size_t i = 0; i < raspdif.buffer.count; i++)
+  {
+    // Configure DMA control block for this buffer, pointing to next block, or first if at end
+    raspdif_configure_dma_control_block(&v_control->control_blocks[i], raspdif_buffer(b_control, i), (raspdif.buffer.size / raspdif.buffer.rows) * sizeof(spdif_frame_code_t), raspdif.buffer.rows, &b_control->control_blocks[(i + 1) % raspdif.buffer.count]);
   }
 
   // Check that blocks loop
-  assert(v_control->control_blocks[RASPDIF_BUFFER_COUNT - 1].next_control_block == PTR32_CAST(&b_control->control_blocks[0]));
+  assert(v_control->control_blocks[raspdif.buffer.count - 1].next_control_block == PTR32_CAST(&b_control->control_blocks[0]));
+
+  // Idle loop repeats itself until linked back to the ring. Lead-in is configured on entry
+  raspdif_configure_dma_control_block(&v_control->idle_loop, &b_control->idle, sizeof(raspdif_idle_buffer_t), 1, &b_control->idle_loop);
+  raspdif_configure_dma_control_block(&v_control->idle_lead_in, &b_control->idle, sizeof(raspdif_idle_buffer_t), 1, &b_control->idle_loop);
+}
+
+/**
+  @brief  Determine the number of rows needed to transfer a buffer. Each row
+          must fit within XLENGTH and evenly divide the buffer
+
+  @param  buffer_size Number of samples in each buffer
+  @retval uint16_t - Number of rows. 0 if the buffer can't be divided
+*/
+static uint16_t raspdif_buffer_rows(uint32_t buffer_size)
+{
+  for (uint32_t rows = 1; rows <= RASPDIF_MAX_BUFFER_ROWS; rows++)
+  {
+    if (buffer_size % rows == 0 && buffer_size / rows <= RASPDIF_MAX_BUFFER_SIZE)
+      return rows;
+  }
+
+  return 0;
+}
+
+/**
+  @brief  Configure the PCM clock for a sample rate. A running clock fed by the same
+          source and MASH filter only has its divisor updated
+
+  @param  sample_rate_hz Audio sample rate in Hertz
+  @retval bool - Clock was configured
+*/
+static bool raspdif_configure_clock(double sample_rate_hz)
+{
+  // Calculate required PCM clock rate for sample rate
+  // 44.1 kHz * 64 bits * 2x (Manchester) -> 5.6448 MHz
+  double spdif_clock = sample_rate_hz * 64.0 * 2.0;
+  LOGD(TAG, "Calculated SPDIF clock of %g Hz for sample rate of %g Hz.", spdif_clock, sample_rate_hz);
+
+  // Pick the source, MASH filter and divisor closest to the SPDIF clock
+  clock_solution_t clock_solution;
+  if (!clock_solver_solve(spdif_clock, raspdif.clock.fractional, &clock_solution))
+    return false;
+
+  // Error against a nominal source rate is only as good as the assumption
+  LOGI(TAG, "PCM clock from %s at %g Hz%s with MASH %d. DIVI: %d, DIVF: %d. Rate error: %.3f ppm, jitter: %.2f ns.", clock_solver_source_name(clock_solution.config.source), clock_solution.source_hz, clock_solution.nominal ? " (nominal, unverified)" : "", clock_solution.config.mash, clock_solution.config.divi, clock_solution.config.divf, clock_solution.error_ppm, clock_solution.jitter_ns);
+
+  bool running = raspdif.clock.divisor > 0;
+  if (running && clock_solution.config.source == raspdif.clock.config.source && clock_solution.config.mash == raspdif.clock.config.mash)
+    bcm283x_clock_set_divisor(clock_peripheral_pcm, clock_solution.config.divi, clock_solution.config.divf);
+  else
+  {
+    bcm283x_clock_configure(clock_peripheral_pcm, &clock_solution.config);
+    bcm283x_clock_enable(clock_peripheral_pcm, true);
+  }
+
+  // Save nominal clock for trimming
+  raspdif.clock.config = clock_solution.config;
+  raspdif.clock.divisor = clock_solution.divisor;
+
+  return true;
 }
 
 /**
   @brief  Initialize hardware for SPDIF generation. Include DMA, Clock, PCM and GPIO config
 
-  @param  dma_channel DMA channel to use for transferring buffers to PCM
+  @param  dma_channel DMA channel to use for transferring buffers to PCM. dma_channel_max to allocate any free channel
   @param  sample_rate_hz Audio sample rate in Hertz for clock configuration
+  @param  buffer_count Number of buffers in the ring
+  @param  buffer_size Number of samples in each buffer
+  @param  bus PCM DREQ thresholds and DMA burst length
+  @param  fractional Require a fractional clock divisor so the rate can be trimmed
   @retval none
 */
-static void raspdif_init(dma_channel_t dma_channel, double sample_rate_hz)
+static void raspdif_init(dma_channel_t dma_channel, double sample_rate_hz, uint8_t buffer_count, uint32_t buffer_size, const raspdif_bus_config_t* bus, bool fractional)
 {
   // Initialize BCM peripheral drivers
   bcm283x_init();
 
-  // Save DMA channel
-  raspdif.dma_channel = dma_channel;
-  LOGD(TAG, "Initializing with DMA channel %d.", dma_channel);
+  // Save bus settings for control block generation
+  raspdif.bus = *bus;
+  LOGD(TAG, "DREQ threshold %d, panic %d, burst %d words.", bus->threshold, bus->panic, bus->burst);
+
+  // Save ring dimensions
+  raspdif.buffer.count = buffer_count;
+  raspdif.buffer.size = buffer_size;
+  raspdif.buffer.rows = raspdif_buffer_rows(buffer_size);
+  LOGD(TAG, "Using %d buffers of %d samples in %d rows.", buffer_count, buffer_size, raspdif.buffer.rows);
+
+  if (raspdif.buffer.rows == 0)
+    LOGF(TAG, "Period of %d samples can't be divided into DMA rows.", buffer_size);
+
+  // Reserve a DMA channel. Only full channels support the 2D mode needed for long periods
+  dma_allocator_init();
+  raspdif.dma_channel = dma_allocator_reserve(dma_channel, raspdif.buffer.rows > 1);
+  if (raspdif.dma_channel == dma_channel_max)
+  {
+    if (dma_channel != dma_channel_max)
+      LOGF(TAG, "DMA channel %d is in use, locked by another instance or unsuitable.", dma_channel);
+    else
+      LOGF(TAG, "No free DMA channel available.%s", (raspdif.buffer.rows > 1) ? " Long periods require a full channel." : "");
+  }
+
+  LOGD(TAG, "Initializing with DMA channel %d.", raspdif.dma_channel);
+
+  // Caches are long enough to fill an entire buffer from any frame phase
+  // Noise cache must also supply every block of the idle buffer
+  raspdif.cache.silence_size = SPDIF_FRAME_COUNT + buffer_size;
+  raspdif.cache.noise_size = RASPDIF_NOISE_CACHE_BLOCKS * SPDIF_FRAME_COUNT + MAX(buffer_size, RASPDIF_IDLE_SIZE);
+  raspdif.cache.silence = malloc(raspdif.cache.silence_size * sizeof(spdif_frame_code_t));
+  raspdif.cache.noise = malloc(raspdif.cache.noise_size * sizeof(spdif_frame_code_t));
+  if (raspdif.cache.silence == NULL || raspdif.cache.noise == NULL)
+    LOGF(TAG, "Failed to allocate caches.");
+
+  // Staging holds a whole buffer, or the idle buffer when writing ahead
+  // Locked and page aligned so it may be the source of DMA copies
+  raspdif.encoder.staging = memory_allocate_virtual(MAX(buffer_size, RASPDIF_IDLE_SIZE) * sizeof(spdif_frame_code_t));
+  if (raspdif.encoder.staging == NULL)
+    LOGF(TAG, "Failed to allocate staging buffer.");
 
   // Allocate buffers and control blocks in physical memory
-  memory_physical_t memory = memory_allocate_physical(sizeof(raspdif_control_t));
+  memory_physical_t memory = memory_allocate_physical(raspdif_control_size());
   if (memory.address == PTR32_NULL)
     LOGF(TAG, "Failed to allocate physical memory.");
 
@@ -186,7 +683,7 @@ static void raspdif_init(dma_channel_t dma_channel, double sample_rate_hz)
   // Map the physical memory into our address space
   uint8_t* bus_base = (uint8_t*)(uintptr_t)memory.address;
   uint8_t* physical_base = bus_base - bcm_host_get_sdram_address();
-  uint8_t* virtual_base = (uint8_t*)memory_map_physical((off_t)physical_base, sizeof(raspdif_control_t));
+  uint8_t* virtual_base = (uint8_t*)memory_map_physical((off_t)physical_base, raspdif_control_size());
   if (virtual_base == NULL)
   {
     // Free physical memory
@@ -212,28 +709,10 @@ static void raspdif_init(dma_channel_t dma_channel, double sample_rate_hz)
   bcm283x_dma_reset(raspdif.dma_channel);
   bcm283x_dma_set_control_block(raspdif.dma_channel, b_control->control_blocks);
 
-  // Calculate required PCM clock rate for sample rate
-  // 44.1 kHz * 64 bits * 2x (Manchester) -> 5.6448 MHz
-  // 500 MHz / 5.6448 = 88.57709750566893
-  double spdif_clock = sample_rate_hz * 64.0 * 2.0;
-  LOGD(TAG, "Calculated SPDIF clock of %g Hz for sample rate of %g Hz.", spdif_clock, sample_rate_hz);
-
-  double pll_freq_hz = bcm_host_is_model_pi4() ? 750e6 : 500e6;
-  double divisor = (pll_freq_hz / spdif_clock);
-
-  double divi = 0;
-  double divf = round(4096 * modf(divisor, &divi));
-  LOGD(TAG, "Calculated DIVI: %d, DIVF: %d.", (uint16_t)divi, (uint16_t)divf);
-
-  clock_configuration_t clock_config;
-  clock_config.source = clock_source_plld;       // 500 MHz
-  clock_config.mash = clock_mash_filter_1_stage; // MASH filters required for non-integer division
-  clock_config.invert = false;
-  clock_config.divi = divi;
-  clock_config.divf = divf;
-
-  bcm283x_clock_configure(clock_peripheral_pcm, &clock_config);
-  bcm283x_clock_enable(clock_peripheral_pcm, true);
+  // Configure PCM clock for the sample rate
+  raspdif.clock.fractional = fractional;
+  if (!raspdif_configure_clock(sample_rate_hz))
+    LOGF(TAG, "Failed to find a clock configuration for sample rate of %g Hz.", sample_rate_hz);
 
   // Reset PCM peripheral
   bcm283x_pcm_reset();
@@ -259,8 +738,8 @@ static void raspdif_init(dma_channel_t dma_channel, double sample_rate_hz)
   pcm_dma_config_t dma_config;
   memset(&dma_config, 0, sizeof(pcm_dma_config_t));
 
-  dma_config.tx_threshold = 32;
-  dma_config.tx_panic = 16;
+  dma_config.tx_threshold = bus->threshold;
+  dma_config.tx_panic = bus->panic;
   bcm283x_pcm_configure_dma(true, &dma_config);
 
   // Configure the transmit channel 1 for 32 bits
@@ -281,126 +760,1310 @@ static void raspdif_init(dma_channel_t dma_channel, double sample_rate_hz)
 }
 
 /**
-  @brief  Encode and store the audio samples into the target buffer
+  @brief  Get the number of samples that can be stored before the current buffer is full
 
-  @param  buffer Buffer to store encoded samples to
-  @param  block SPDIF block so proper frames can be encoded
-  @param  format Format of samples
-  @param  sample_a Audio sample for first channel
-  @param  sample_b Audio sample for second channel
-  @retval bool - Provided buffer is now full
+  @param  none
+  @retval size_t - Free samples in current buffer
 */
-static bool raspdif_buffer_samples(raspdif_buffer_t* buffer, spdif_block_t* block, raspdif_format_t format, int32_t sample_a, int32_t sample_b)
+static size_t raspdif_buffer_free()
 {
-  static uint8_t frame_index = 0;   // Position within SPDIF block
-  static uint32_t sample_count = 0; // Number of samples received. At 44.1 kHz will overflow at 13 hours
-
-  spdif_sample_depth_t bit_depth = (format == raspdif_format_s24le) ? spdif_sample_depth_24 : spdif_sample_depth_16;
+  // While writing ahead the encoder fills the idle buffer to its end
+  uint32_t size = raspdif.idle.write_ahead ? RASPDIF_IDLE_SIZE : raspdif.buffer.size;
 
-  spdif_frame_t* frame = &block->frames[frame_index];
+  return size - raspdif.encoder.buffer_offset;
+}
 
-  uint64_t code_a = spdif_build_subframe(&frame->a, frame_index == 0 ? spdif_preamble_b : spdif_preamble_m, bit_depth, sample_a);
-  buffer->sample[sample_count % RASPDIF_BUFFER_SIZE].a.msb = code_a >> 32;
-  buffer->sample[sample_count % RASPDIF_BUFFER_SIZE].a.lsb = code_a;
+/**
+  @brief  Get the SPDIF sample depth for the sample format
 
-  uint64_t code_b = spdif_build_subframe(&frame->b, spdif_preamble_w, bit_depth, sample_b);
-  buffer->sample[sample_count % RASPDIF_BUFFER_SIZE].b.msb = code_b >> 32;
-  buffer->sample[sample_count % RASPDIF_BUFFER_SIZE].b.lsb = code_b;
+  @param  format Format of samples
+  @retval spdif_sample_depth_t
+*/
+static spdif_sample_depth_t raspdif_sample_depth(raspdif_format_t format)
+{
+  return (format == raspdif_format_s24le) ? spdif_sample_depth_24 : spdif_sample_depth_16;
+}
 
-  frame_index = (frame_index + 1) % SPDIF_FRAME_COUNT;
-  sample_count++;
+/**
+  @brief  Get the size of a stereo frame of input
 
-  return sample_count % RASPDIF_BUFFER_SIZE == 0;
+  @param  format Format of samples
+  @retval uint8_t - Size in bytes
+*/
+static uint8_t raspdif_frame_size(raspdif_format_t format)
+{
+  return 2 * ((format == raspdif_format_s24le) ? 3 : sizeof(int16_t));
 }
 
 /**
-  @brief  Parse and sign extend the sample of the specified format
+  @brief  Set up a second DMA channel to commit staged samples. Falls back to
+          copying with the CPU if no channel is available
 
-  @param  format Sample format to parse
-  @param  buffer Buffer containing raw sample bytes
-  @retval int32_t - Sign extended sample
+  @param  none
+  @retval none
 */
-static int32_t raspdif_parse_sample(raspdif_format_t format, uint8_t* buffer)
+static void raspdif_copy_init()
 {
-  if (format == raspdif_format_s16le)
-    return (int16_t)(buffer[1] << 8 | buffer[0]);
+  dma_channel_t channel = dma_allocator_reserve(dma_channel_max, false);
+  if (channel == dma_channel_max)
+  {
+    LOGW(TAG, "No DMA channel available for copies. Copying with CPU.");
+    return;
+  }
 
-  // Sign-extend buffer to int32_t
-  struct
+  size_t length = MAX(raspdif.buffer.size, RASPDIF_IDLE_SIZE) * sizeof(spdif_frame_code_t);
+  if (!copy_init(&raspdif.copy.engine, channel, raspdif.encoder.staging, length))
   {
-    signed int x : 24;
-  } s;
-  return s.x = buffer[2] << 16 | buffer[1] << 8 | buffer[0];
+    dma_allocator_release(channel);
+    LOGW(TAG, "Failed to set up DMA copies. Copying with CPU.");
+    return;
+  }
+
+  raspdif.copy.enabled = true;
 }
 
 /**
-  @brief  Fill all buffers with white noise or zeros
+  @brief  Check on the DMA copy in flight. A failed copy is redone with the CPU
+          and copying falls back to the CPU for good
 
-  @param  buffer_index Current buffer index to start filling from
-  @param  block SPDIF block so proper frames can be encoded
-  @param  format Format of samples
-  @param  sample_rate Sample rate to estimate latency when delaying on DMA
-  @param  keep_alive Transmit quiet white noise to keep equipment alive
+  @param  wait Block until the copy completes so its staged samples can be reused
   @retval none
 */
-static void raspdif_fill_buffers(uint8_t buffer_index, spdif_block_t* block, raspdif_format_t format, double sample_rate, bool keep_alive)
+static void raspdif_copy_check(bool wait)
 {
-  // Seed random generator if using keep-alive
-  if (keep_alive)
-    srand(time(NULL));
+  if (!raspdif.copy.enabled || raspdif.copy.count == 0)
+    return;
 
-// Macro to generate samples for fill
-#define FILL_SAMPLE (keep_alive ? ((rand() % 10) - 5) : 0)
+  copy_status_t status = wait ? copy_wait(&raspdif.copy.engine) : copy_poll(&raspdif.copy.engine);
+  if (status == copy_status_busy)
+    return;
 
-  // Zero fill remainder of current buffer
-  raspdif_buffer_t* buffer = &raspdif.control.virtual->buffers[buffer_index];
-  while (!raspdif_buffer_samples(buffer, block, format, FILL_SAMPLE, FILL_SAMPLE))
+  if (status == copy_status_failed)
   {
-  }
-
-  buffer_index = (buffer_index + 1) % RASPDIF_BUFFER_COUNT;
-
-  // Fill all the buffers, while waiting on DMA if necessary
-  uint8_t fill_count = 0;
-  while (fill_count < RASPDIF_BUFFER_COUNT)
-  {
-    if (bcm283x_dma_get_control_block(raspdif.dma_channel) == &raspdif.control.bus->control_blocks[buffer_index])
-    {
-      // If DMA is using current buffer, delay by approx 1 buffer's duration
-      microsleep(1e6 * (RASPDIF_BUFFER_SIZE / sample_rate));
-      continue;
-    }
-
-    raspdif_buffer_t* buffer = &raspdif.control.virtual->buffers[buffer_index];
-    while (!raspdif_buffer_samples(buffer, block, format, FILL_SAMPLE, FILL_SAMPLE))
-    {
-    }
+    LOGW(TAG, "Disabling DMA copies. Copying with CPU.");
 
-    buffer_index = (buffer_index + 1) % RASPDIF_BUFFER_COUNT;
+    copy_release(&raspdif.copy.engine);
+    dma_allocator_release(raspdif.copy.engine.channel);
+    raspdif.copy.enabled = false;
 
-    fill_count++;
+    memory_copy_uncached(&raspdif.copy.buffer[raspdif.copy.offset], &raspdif.encoder.staging[raspdif.copy.offset], raspdif.copy.count * sizeof(spdif_frame_code_t));
   }
+
+  raspdif.copy.count = 0;
 }
 
 /**
-  @brief  Callback function for POSIX signals
+  @brief  Commit a range of staged samples into DMA memory. A DMA copy is only
+          started here and is checked on the next pass of the main loop
 
-  @param  signal Received POSIX signal
+  @param  buffer Buffer in DMA memory matching the staging buffer
+  @param  offset Index of first sample to commit
+  @param  count Number of samples to commit
   @retval none
 */
-static void signal_handler(int32_t signal)
+static void raspdif_commit(spdif_frame_code_t* buffer, uint32_t offset, size_t count)
 {
-  LOGW(TAG, "Received signal %s (%d).", strsignal(signal), signal);
+  // Copy engine handles one range at a time
+  raspdif_copy_check(true);
 
-  raspdif_shutdown();
+  if (raspdif.copy.enabled)
+  {
+    if (count == 0)
+      return;
 
-  // Terminate
-  exit(EXIT_SUCCESS);
+    copy_start(&raspdif.copy.engine, offset * sizeof(spdif_frame_code_t), raspdif_bus_address(&buffer[offset]), count * sizeof(spdif_frame_code_t));
+
+    raspdif.copy.buffer = buffer;
+    raspdif.copy.offset = offset;
+    raspdif.copy.count = count;
+    return;
+  }
+
+  memory_copy_uncached(&buffer[offset], &raspdif.encoder.staging[offset], count * sizeof(spdif_frame_code_t));
 }
 
 /**
-  @brief  Register a handler for all POSIX signals
-          that would cause termination
+  @brief  Encode and store the audio samples into the target buffer. Samples are
+          encoded into cached staging memory and committed once the buffer is full
+
+  @param  buffer Buffer to store encoded samples to
+  @param  block SPDIF block so proper frames can be encoded
+  @param  format Format of samples
+  @param  samples Interleaved audio samples. 2 per frame
+  @param  count Number of frames to store. Must not exceed free space in buffer
+  @retval bool - Provided buffer is now full
+*/
+static bool raspdif_buffer_samples(spdif_frame_code_t* buffer, const spdif_block_t* block, raspdif_format_t format, const int32_t* samples, size_t count)
+{
+  assert(count <= raspdif_buffer_free());
+
+  // Staging memory can't be written while a copy is reading it
+  raspdif_copy_check(true);
+
+  uint32_t offset = raspdif.encoder.buffer_offset;
+  raspdif.encoder.frame_index = spdif_encode_frames(block, raspdif.encoder.frame_index, raspdif_sample_depth(format), samples, count, &raspdif.encoder.staging[offset]);
+  raspdif.encoder.buffer_offset += count;
+
+  // DMA is already reading the idle buffer so audio written ahead is committed immediately
+  if (raspdif.idle.write_ahead)
+    raspdif_commit(buffer, offset, count);
+
+  if (raspdif_buffer_free() > 0)
+    return false;
+
+  if (!raspdif.idle.write_ahead)
+    raspdif_commit(buffer, 0, raspdif.buffer.size);
+
+  raspdif.encoder.buffer_offset = 0;
+  return true;
+}
+
+/**
+  @brief  Parse and sign extend multiple samples of the specified format
+
+  @param  format Sample format to parse
+  @param  buffer Buffer containing raw sample bytes
+  @param  samples Destination for parsed samples
+  @param  count Number of samples to parse
+  @retval none
+*/
+static void raspdif_parse_samples(raspdif_format_t format, const uint8_t* buffer, int32_t* samples, size_t count)
+{
+  if (format == raspdif_format_s24le)
+    sample_unpack_s24le(buffer, samples, count);
+  else
+    sample_unpack_s16le(buffer, samples, count);
+}
+
+/**
+  @brief  Encode a run of white noise or zeros into the cache starting at frame phase 0
+
+  @param  codes Cache to encode into
+  @param  count Number of frames to encode
+  @param  block SPDIF block so proper frames can be encoded
+  @param  format Format of samples
+  @param  noise Encode quiet white noise instead of zeros
+  @retval none
+*/
+static void raspdif_encode_cache(spdif_frame_code_t* codes, size_t count, const spdif_block_t* block, raspdif_format_t format, bool noise)
+{
+  int32_t samples[2 * RASPDIF_CHUNK_SIZE];
+  memset(samples, 0, sizeof(samples));
+
+  uint8_t frame_index = 0;
+  while (count > 0)
+  {
+    size_t chunk = MIN(count, RASPDIF_CHUNK_SIZE);
+
+    if (noise)
+    {
+      for (size_t i = 0; i < 2 * chunk; i++)
+        samples[i] = (rand() % 10) - 5;
+    }
+
+    frame_index = spdif_encode_frames(block, frame_index, raspdif_sample_depth(format), samples, chunk, codes);
+
+    codes += chunk;
+    count -= chunk;
+  }
+}
+
+/**
+  @brief  Start resampling input to the output rate, replacing any previous resampler
+
+  @param  input_rate Input sample rate in Hertz
+  @param  output_rate Output sample rate in Hertz
+  @param  format Format of input samples
+  @retval bool - Rates are supported. The previous resampler is kept if not
+*/
+static bool raspdif_resample_init(double input_rate, double output_rate, raspdif_format_t format)
+{
+  resample_t engine;
+  if (!resample_init(&engine, input_rate, output_rate, raspdif.resample.quality, (format == raspdif_format_s24le) ? 24 : 16))
+    return false;
+
+  if (raspdif.resample.enabled)
+    resample_release(&raspdif.resample.engine);
+
+  raspdif.resample.engine = engine;
+  raspdif.resample.enabled = true;
+  raspdif.resample.count = 0;
+  raspdif.resample.offset = 0;
+  raspdif.resample.flushed = false;
+
+  return true;
+}
+
+/**
+  @brief  Get the number of whole frames ready in the fullest input
+
+  @param  frame_size Size of a frame in bytes
+  @retval size_t
+*/
+static size_t raspdif_input_frames(uint8_t frame_size)
+{
+  if (raspdif.mix.count == 0)
+    return input_available(&raspdif.input) / frame_size;
+
+  size_t frames = 0;
+  for (uint8_t i = 0; i < raspdif.mix.count; i++)
+    frames = MAX(frames, input_available(raspdif.mix.sources[i].input) / frame_size);
+
+  return frames;
+}
+
+/**
+  @brief  Check if every input has ended, leaving less than a frame
+
+  @param  frame_size Size of a frame in bytes
+  @retval bool
+*/
+static bool raspdif_input_ended(uint8_t frame_size)
+{
+  if (raspdif.mix.count == 0)
+    return input_eof(&raspdif.input) && input_available(&raspdif.input) < frame_size;
+
+  for (uint8_t i = 0; i < raspdif.mix.count; i++)
+  {
+    input_t* input = raspdif.mix.sources[i].input;
+    if (!input_eof(input) || input_available(input) >= frame_size)
+      return false;
+  }
+
+  return true;
+}
+
+/**
+  @brief  Parse and mix as many frames as every input with audio can supply.
+          Inputs without audio are silent. Inputs below the highest active
+          priority are ducked
+
+  @param  format Format of samples
+  @param  samples Destination for mixed samples
+  @param  max Maximum number of frames. At most RASPDIF_CHUNK_SIZE
+  @retval size_t - Number of frames. 0 if no input has audio
+*/
+static size_t raspdif_mix_inputs(raspdif_format_t format, int32_t* samples, size_t max)
+{
+  assert(max <= RASPDIF_CHUNK_SIZE);
+
+  uint8_t frame_size = raspdif_frame_size(format);
+  const uint8_t* frames = NULL;
+
+  size_t count = max;
+  bool active = false;
+  for (uint8_t i = 0; i < raspdif.mix.count; i++)
+  {
+    size_t available = input_peek(raspdif.mix.sources[i].input, &frames) / frame_size;
+    assert(available > 0 || input_available(raspdif.mix.sources[i].input) < frame_size); // Frames never straddle the end of a ring
+    if (available == 0)
+      continue;
+
+    count = MIN(count, available);
+    active = true;
+  }
+
+  if (!active)
+    return 0;
+
+  // Inputs duck others while they have audio and for a hold time after
+  uint8_t priority = 0;
+  for (uint8_t i = 0; i < raspdif.mix.count; i++)
+  {
+    if (input_peek(raspdif.mix.sources[i].input, &frames) >= frame_size)
+      raspdif.mix.sources[i].hold = raspdif.mix.hold_frames;
+    else
+      raspdif.mix.sources[i].hold -= MIN(raspdif.mix.sources[i].hold, count);
+
+    if (raspdif.mix.sources[i].hold > 0)
+      priority = MAX(priority, raspdif.mix.sources[i].priority);
+  }
+
+  memset(samples, 0, 2 * count * sizeof(int32_t));
+
+  int32_t parsed[2 * RASPDIF_CHUNK_SIZE];
+  for (uint8_t i = 0; i < raspdif.mix.count; i++)
+  {
+    input_t* input = raspdif.mix.sources[i].input;
+    mix_gain_t* gain = &raspdif.mix.sources[i].gain;
+
+    mix_gain_set(gain, (raspdif.mix.sources[i].priority < priority) ? raspdif.mix.duck : MIX_UNITY);
+
+    if (input_peek(input, &frames) < count * frame_size)
+      continue;
+
+    raspdif_parse_samples(format, frames, parsed, 2 * count);
+    input_consume(input, count * frame_size);
+
+    mix_accumulate(samples, parsed, count, gain);
+  }
+
+  mix_clamp(samples, 2 * count, (format == raspdif_format_s24le) ? 24 : 16);
+
+  return count;
+}
+
+/**
+  @brief  Parse the next batch of frames from the input, or mix them from every input,
+          and apply the volume
+
+  @param  format Format of samples
+  @param  samples Destination for parsed samples
+  @param  max Maximum number of frames. At most RASPDIF_CHUNK_SIZE
+  @retval size_t - Number of frames. 0 if no input has audio
+*/
+static size_t raspdif_take_input(raspdif_format_t format, int32_t* samples, size_t max)
+{
+  size_t count = 0;
+  if (raspdif.mix.count > 0)
+    count = raspdif_mix_inputs(format, samples, max);
+  else
+  {
+    uint8_t frame_size = raspdif_frame_size(format);
+    const uint8_t* frames = NULL;
+
+    count = MIN(input_peek(&raspdif.input, &frames) / frame_size, max);
+    assert(count > 0 || input_available(&raspdif.input) < frame_size); // Frames never straddle the end of the ring
+
+    // Parse sample buffer in proper format
+    raspdif_parse_samples(format, frames, samples, 2 * count);
+    input_consume(&raspdif.input, count * frame_size);
+  }
+
+  // Attenuation never exceeds the range of the format so no clamp is needed
+  if (raspdif.volume.enabled)
+    mix_scale(samples, count, &raspdif.volume.gain);
+
+  return count;
+}
+
+/**
+  @brief  Take the next batch of samples from the input, resampling if enabled
+
+  @param  format Format of input samples
+  @param  scratch Storage for parsed samples of at least RASPDIF_CHUNK_SIZE frames
+  @param  max Maximum number of frames to take
+  @param  samples Set to the interleaved samples taken
+  @retval size_t - Number of frames. 0 if the input is empty
+*/
+static size_t raspdif_read_samples(raspdif_format_t format, int32_t* scratch, size_t max, const int32_t** samples)
+{
+  if (!raspdif.resample.enabled)
+  {
+    *samples = scratch;
+    return raspdif_take_input(format, scratch, MIN(max, RASPDIF_CHUNK_SIZE));
+  }
+
+  // Filter delay may consume several batches before output is ready
+  while (raspdif.resample.offset == raspdif.resample.count)
+  {
+    size_t count = raspdif_take_input(format, scratch, MIN(RASPDIF_CHUNK_SIZE, RESAMPLE_CHUNK_SIZE));
+    if (count == 0 && (raspdif.resample.flushed || !raspdif_input_ended(raspdif_frame_size(format))))
+      return 0;
+
+    if (count == 0)
+    {
+      // Push the filter's history out with silence so the end of the stream is heard
+      count = raspdif.resample.engine.taps;
+      memset(scratch, 0, 2 * count * sizeof(int32_t));
+      raspdif.resample.flushed = true;
+    }
+
+    raspdif.resample.count = resample_process(&raspdif.resample.engine, scratch, count, raspdif.resample.output);
+    raspdif.resample.offset = 0;
+  }
+
+  // Hand out resampled frames in place
+  size_t count = MIN(raspdif.resample.count - raspdif.resample.offset, max);
+  *samples = &raspdif.resample.output[2 * raspdif.resample.offset];
+  raspdif.resample.offset += count;
+
+  return count;
+}
+
+/**
+  @brief  Pre-encode the silence and keep-alive caches used to fill buffers during underrun.
+          Must be rebuilt if the block or format changes
+
+  @param  block SPDIF block so proper frames can be encoded
+  @param  format Format of samples
+  @retval none
+*/
+static void raspdif_build_cache(const spdif_block_t* block, raspdif_format_t format)
+{
+  // Seed random generator for keep-alive noise
+  srand(time(NULL));
+
+  raspdif_encode_cache(raspdif.cache.silence, raspdif.cache.silence_size, block, format, false);
+  raspdif_encode_cache(raspdif.cache.noise, raspdif.cache.noise_size, block, format, true);
+}
+
+/**
+  @brief  Fill the remainder of the target buffer with white noise or zeros from the cache
+
+  @param  buffer Buffer to fill
+  @param  keep_alive Transmit quiet white noise to keep equipment alive
+  @retval none
+*/
+static void raspdif_fill_buffer(spdif_frame_code_t* buffer, bool keep_alive)
+{
+  size_t count = raspdif_buffer_free();
+
+  // Start from the cache entry matching the current frame phase
+  // Noise begins at a random block so repeated fills don't replay the same pattern
+  const spdif_frame_code_t* source = &raspdif.cache.silence[raspdif.encoder.frame_index];
+  if (keep_alive)
+    source = &raspdif.cache.noise[(rand() % RASPDIF_NOISE_CACHE_BLOCKS) * SPDIF_FRAME_COUNT + raspdif.encoder.frame_index];
+
+  // Commit the staged samples then fill the remainder straight from the cache
+  assert(!raspdif.idle.write_ahead);
+  raspdif_commit(buffer, 0, raspdif.encoder.buffer_offset);
+  memory_copy_uncached(&buffer[raspdif.encoder.buffer_offset], source, count * sizeof(spdif_frame_code_t));
+
+  raspdif.encoder.frame_index = (raspdif.encoder.frame_index + count) % SPDIF_FRAME_COUNT;
+  raspdif.encoder.buffer_offset = 0;
+}
+
+/**
+  @brief  Populate the idle buffer with encoded silence or keep-alive noise from the cache
+
+  @param  keep_alive Transmit quiet white noise to keep equipment alive
+  @retval none
+*/
+static void raspdif_build_idle(bool keep_alive)
+{
+  const spdif_frame_code_t* source = keep_alive ? raspdif.cache.noise : raspdif.cache.silence;
+
+  // Audio written ahead may still be copying into the idle buffer
+  raspdif_copy_check(true);
+
+  for (size_t i = 0; i < RASPDIF_IDLE_BLOCKS; i++)
+  {
+    // Noise cache is long enough to supply every block, silence is identical for each
+    size_t offset = keep_alive ? i * SPDIF_FRAME_COUNT : 0;
+    memory_copy_uncached(&raspdif.control.virtual->idle.sample[i * SPDIF_FRAME_COUNT], &source[offset], SPDIF_FRAME_COUNT * sizeof(spdif_frame_code_t));
+  }
+}
+
+/**
+  @brief  Queue commands received on the control socket until the ring drains.
+          Volume changes apply from the next samples encoded
+
+  @param  none
+  @retval none
+*/
+static void raspdif_command_receive()
+{
+  control_command_t command;
+  while (control_receive(&raspdif.command.socket, &command))
+  {
+    if (command.type == control_command_volume)
+    {
+      LOGI(TAG, "Volume set to %g dB.", command.volume);
+      mix_gain_set(&raspdif.volume.gain, mix_gain_from_db(command.volume));
+      control_reply(&raspdif.command.socket, &command, "ok");
+      continue;
+    }
+
+    if (raspdif.command.count >= RASPDIF_MAX_PENDING_COMMANDS)
+    {
+      control_reply(&raspdif.command.socket, &command, "error busy");
+      continue;
+    }
+
+    raspdif.command.pending[raspdif.command.count++] = command;
+  }
+}
+
+/**
+  @brief  Check the sticky PCM underflow and DMA error flags
+
+  @param  none
+  @retval none
+*/
+static void raspdif_stats_update()
+{
+  if (!raspdif.stats.enabled)
+    return;
+
+  raspdif.stats.checks++;
+
+  if (bcm283x_pcm_check_transmit_error())
+    raspdif.stats.underflows++;
+
+  dma_debug_t debug = bcm283x_dma_check_errors(raspdif.dma_channel);
+  if (debug.READ_ERROR || debug.FIFO_ERROR || debug.READ_LAST_NOT_SET_ERROR)
+  {
+    raspdif.stats.dma_errors++;
+    LOGD(TAG, "DMA error. Read: %d, FIFO: %d, Read last not set: %d.", debug.READ_ERROR, debug.FIFO_ERROR, debug.READ_LAST_NOT_SET_ERROR);
+  }
+}
+
+/**
+  @brief  Log the checks which found errors over the last interval. Run from
+          the stats timer so reports arrive on schedule even while idle
+
+  @param  none
+  @retval none
+*/
+static void raspdif_stats_report()
+{
+  // Flags are sticky so each check only shows whether any event occurred since the last
+  raspdif_stats_update();
+
+  LOGI(TAG, "Checks with PCM underflow: %u of %u, with DMA errors: %u of %u in %d s.", raspdif.stats.underflows, raspdif.stats.checks, raspdif.stats.dma_errors, raspdif.stats.checks, RASPDIF_STATS_INTERVAL_S);
+
+  raspdif.stats.checks = 0;
+  raspdif.stats.underflows = 0;
+  raspdif.stats.dma_errors = 0;
+}
+
+/**
+  @brief  Create the event loop. Termination signals are blocked and received via signalfd
+          so they must be set up before any threads are created
+
+  @param  none
+  @retval none
+*/
+static void raspdif_loop_init()
+{
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGHUP);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGQUIT);
+  sigaddset(&mask, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  raspdif.loop.signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+  raspdif.loop.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  raspdif.loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (raspdif.loop.signal_fd == -1 || raspdif.loop.timer_fd == -1 || raspdif.loop.epoll_fd == -1)
+    LOGF(TAG, "Failed to create event loop. Error: %s.", strerror(errno));
+
+  raspdif.loop.running = true;
+}
+
+/**
+  @brief  Add a file descriptor to the event loop
+
+  @param  fd File descriptor to watch for input
+  @retval none
+*/
+static void raspdif_loop_watch(int32_t fd)
+{
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+
+  if (epoll_ctl(raspdif.loop.epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    LOGF(TAG, "Failed to watch file descriptor. Error: %s.", strerror(errno));
+}
+
+/**
+  @brief  Wait for input, a timeout or a termination request
+
+  @param  timeout_us Time to wait in microseconds. 0 to wait on events only
+  @retval bool - Loop should keep running
+*/
+static bool raspdif_loop_wait(uint32_t timeout_us)
+{
+  // Arm or disarm the one-shot timer
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = timeout_us / 1000000;
+  spec.it_value.tv_nsec = (timeout_us % 1000000) * 1000;
+  timerfd_settime(raspdif.loop.timer_fd, 0, &spec, NULL);
+
+  // Producers only wake the loop while it sleeps on an empty ring
+  input_prepare_wait(&raspdif.input);
+
+  struct epoll_event events[4];
+  int32_t count = epoll_wait(raspdif.loop.epoll_fd, events, 4, -1);
+  if (count == -1 && errno != EINTR)
+    LOGE(TAG, "Failed to wait for events. Error: %s.", strerror(errno));
+
+  for (int32_t i = 0; i < count; i++)
+  {
+    int32_t fd = events[i].data.fd;
+    if (fd == raspdif.loop.signal_fd)
+    {
+      struct signalfd_siginfo info;
+      if (read(fd, &info, sizeof(info)) == sizeof(info))
+        LOGW(TAG, "Received signal %s (%d).", strsignal(info.ssi_signo), info.ssi_signo);
+
+      raspdif.loop.running = false;
+    }
+    else if (raspdif.command.enabled && fd == raspdif.command.socket.fd)
+    {
+      raspdif_command_receive();
+    }
+    else if (raspdif.stats.enabled && fd == raspdif.stats.timer_fd)
+    {
+      uint64_t expirations;
+      read(fd, &expirations, sizeof(expirations));
+
+      raspdif_stats_report();
+    }
+    else
+    {
+      // Reset timer and input eventfds
+      uint64_t value;
+      read(fd, &value, sizeof(value));
+    }
+  }
+
+  return raspdif.loop.running;
+}
+
+/**
+  @brief  Get the number of samples the DMA has left to transfer in the active control block
+
+  @param  none
+  @retval uint32_t - Remaining samples
+*/
+static uint32_t raspdif_dma_remaining_frames()
+{
+  dma_transfer_length_t length = bcm283x_dma_get_transfer_length(raspdif.dma_channel);
+
+  // In 2D mode YLENGTH counts the rows after the current one. It's zero for the linear idle blocks
+  uint32_t row = (raspdif.buffer.size / raspdif.buffer.rows) * sizeof(spdif_frame_code_t);
+  uint32_t bytes = length.XLENGTH + ((raspdif.buffer.rows > 1) ? length.YLENGTH * row : 0);
+
+  return bytes / sizeof(spdif_frame_code_t);
+}
+
+/**
+  @brief  Predict the time until the DMA completes the active control block
+
+  @param  sample_rate Sample rate to convert frames to time
+  @retval uint32_t - Time in microseconds
+*/
+static uint32_t raspdif_dma_remaining_us(double sample_rate)
+{
+  uint32_t frames = raspdif_dma_remaining_frames();
+
+  // Wake slightly after completion so the DMA has loaded the next block
+  return 1e6 * (frames / sample_rate) + RASPDIF_WAKE_MARGIN_US;
+}
+
+/**
+  @brief  Check if the DMA is executing the idle loop
+
+  @param  none
+  @retval bool
+*/
+static bool raspdif_dma_in_idle()
+{
+  const dma_control_block_t* control = bcm283x_dma_get_control_block(raspdif.dma_channel);
+
+  return control == &raspdif.control.bus->idle_lead_in || control == &raspdif.control.bus->idle_loop;
+}
+
+/**
+  @brief  Get the position of the DMA within the idle buffer. Both the lead-in
+          and the loop end at the end of the idle buffer
+
+  @param  none
+  @retval uint32_t - Index of next sample to be transferred
+*/
+static uint32_t raspdif_dma_idle_position()
+{
+  uint32_t frames = bcm283x_dma_get_transfer_length(raspdif.dma_channel).XLENGTH / sizeof(spdif_frame_code_t);
+
+  return RASPDIF_IDLE_SIZE - MIN(frames, RASPDIF_IDLE_SIZE);
+}
+
+/**
+  @brief  Check if the DMA is using the target buffer. While idle the DMA
+          is considered to be on the buffer that leads into the idle loop
+
+  @param  buffer_index Index of buffer to check
+  @retval bool
+*/
+static bool raspdif_dma_on_buffer(uint8_t buffer_index)
+{
+  if (raspdif.idle.entered && buffer_index == raspdif.idle.buffer_index && raspdif_dma_in_idle())
+    return true;
+
+  return bcm283x_dma_get_control_block(raspdif.dma_channel) == &raspdif.control.bus->control_blocks[buffer_index];
+}
+
+/**
+  @brief  Get the number of encoded frames which have not been transmitted yet
+
+  @param  buffer_index Current buffer index
+  @retval uint32_t - Frames queued ahead of the DMA
+*/
+static uint32_t raspdif_dma_delay(uint8_t buffer_index)
+{
+  const dma_control_block_t* control = bcm283x_dma_get_control_block(raspdif.dma_channel);
+
+  // Remaining frames of the active control block
+  uint32_t frames = raspdif_dma_remaining_frames();
+
+  // Audio written ahead is queued from the DMA position within the idle buffer
+  if (raspdif.idle.write_ahead)
+  {
+    uint32_t position = raspdif_dma_idle_position();
+    return (raspdif.encoder.buffer_offset > position) ? raspdif.encoder.buffer_offset - position : 0;
+  }
+
+  // Buffers after the active one, up to the buffer being filled
+  // While idle, audio resumes after the buffer that led into the loop
+  ptrdiff_t dma_index = control - raspdif.control.bus->control_blocks;
+  if (raspdif.idle.entered && raspdif_dma_in_idle())
+    dma_index = raspdif.idle.buffer_index;
+  else if (dma_index < 0 || dma_index >= raspdif.buffer.count)
+    return 0;
+
+  uint8_t full_buffers = (buffer_index + raspdif.buffer.count - dma_index - 1) % raspdif.buffer.count;
+
+  return frames + full_buffers * raspdif.buffer.size + raspdif.encoder.buffer_offset;
+}
+
+/**
+  @brief  Wait for the DMA to enter or leave the idle loop
+
+  @param  idle Wait for the DMA to be in the idle loop
+  @param  sample_rate Sample rate to estimate latency when delaying on DMA
+  @retval none
+*/
+static void raspdif_wait_dma_idle(bool idle, double sample_rate)
+{
+  while (raspdif_dma_in_idle() != idle && raspdif_loop_wait(raspdif_dma_remaining_us(sample_rate)))
+    continue;
+}
+
+/**
+  @brief  Switch the ring to the idle loop. Fills the remainder of the current
+          buffer then links it to the lead-in of the idle loop. Returns once
+          the DMA is executing the idle loop
+
+  @param  buffer_index Current buffer index
+  @param  sample_rate Sample rate to estimate latency when delaying on DMA
+  @param  keep_alive Transmit quiet white noise to keep equipment alive
+  @retval none
+*/
+static void raspdif_idle_enter(uint8_t buffer_index, double sample_rate, bool keep_alive)
+{
+  raspdif_control_t* b_control = raspdif.control.bus;
+  raspdif_control_t* v_control = raspdif.control.virtual;
+
+  if (raspdif.idle.entered && !raspdif.idle.exiting)
+  {
+    // Data returned but didn't fill a buffer. The DMA is still in the idle loop so
+    // link the partial buffer between the loop and a new lead-in and leave it once
+    raspdif_fill_buffer(raspdif_buffer(v_control, buffer_index), keep_alive);
+
+    // Safe to rewrite the lead-in even if it's active, DMA has already loaded it
+    v_control->idle_lead_in.source_address = PTR32_CAST(&b_control->idle.sample[raspdif.encoder.frame_index]);
+    v_control->idle_lead_in.transfer_length.XLENGTH = sizeof(raspdif_idle_buffer_t) - raspdif.encoder.frame_index * sizeof(spdif_frame_code_t);
+    v_control->control_blocks[buffer_index].next_control_block = PTR32_CAST(&b_control->idle_lead_in);
+    v_control->idle_loop.next_control_block = PTR32_CAST(&b_control->control_blocks[buffer_index]);
+
+    raspdif_wait_dma_idle(false, sample_rate);
+    v_control->idle_loop.next_control_block = PTR32_CAST(&b_control->idle_loop);
+
+    raspdif.idle.buffer_index = buffer_index;
+    raspdif_wait_dma_idle(true, sample_rate);
+    return;
+  }
+
+  if (raspdif.idle.exiting)
+  {
+    // Loop must repeat itself before it can be reused
+    raspdif_wait_dma_idle(false, sample_rate);
+    v_control->idle_loop.next_control_block = PTR32_CAST(&b_control->idle_loop);
+
+    raspdif.idle.entered = false;
+    raspdif.idle.exiting = false;
+
+    // Data ran out while writing ahead. Continue from the start of the buffer after the loop
+    if (raspdif.idle.write_ahead)
+    {
+      raspdif.idle.write_ahead = false;
+      raspdif.encoder.buffer_offset = 0;
+      raspdif.encoder.frame_index = 0;
+    }
+  }
+
+  // DMA has left the idle loop so replace any audio written ahead
+  if (raspdif.idle.dirty)
+  {
+    raspdif_build_idle(keep_alive);
+    raspdif.idle.dirty = false;
+  }
+
+  while (true)
+  {
+    raspdif_fill_buffer(raspdif_buffer(v_control, buffer_index), keep_alive);
+
+    // Start the idle buffer at the frame phase where this buffer ends
+    v_control->idle_lead_in.source_address = PTR32_CAST(&b_control->idle.sample[raspdif.encoder.frame_index]);
+    v_control->idle_lead_in.transfer_length.XLENGTH = sizeof(raspdif_idle_buffer_t) - raspdif.encoder.frame_index * sizeof(spdif_frame_code_t);
+    v_control->control_blocks[buffer_index].next_control_block = PTR32_CAST(&b_control->idle_lead_in);
+
+    // Check if the DMA loaded this buffer before it was relinked
+    if (bcm283x_dma_get_control_block(raspdif.dma_channel) != &b_control->control_blocks[buffer_index] ||
+        bcm283x_dma_get_next_control_block(raspdif.dma_channel) == &b_control->idle_lead_in)
+      break;
+
+    // Restore link and try again from the next buffer
+    LOGD(TAG, "DMA passed buffer %d before idle.", buffer_index);
+    v_control->control_blocks[buffer_index].next_control_block = PTR32_CAST(&b_control->control_blocks[(buffer_index + 1) % raspdif.buffer.count]);
+    buffer_index = (buffer_index + 1) % raspdif.buffer.count;
+  }
+
+  raspdif.idle.buffer_index = buffer_index;
+  raspdif.idle.entered = true;
+
+  raspdif_wait_dma_idle(true, sample_rate);
+}
+
+/**
+  @brief  Start writing audio into the idle buffer a safety margin ahead of the DMA
+          and link the current pass of the idle loop directly to the ring. Playback
+          resumes within the margin instead of after one or two passes of the loop
+
+  @param  buffer_index Index of the buffer after the idle loop
+  @param  sample_rate Sample rate to convert the margin to frames
+  @param  keep_alive Transmit quiet white noise to keep equipment alive
+  @retval none
+*/
+static void raspdif_idle_write_ahead(uint8_t buffer_index, double sample_rate, bool keep_alive)
+{
+  raspdif_control_t* b_control = raspdif.control.bus;
+  raspdif_control_t* v_control = raspdif.control.virtual;
+
+  uint32_t margin = sample_rate * RASPDIF_WRITE_AHEAD_US / 1e6;
+
+  // The buffer after the loop may play before it's filled, replace stale audio with silence
+  raspdif_copy_check(true);
+  const spdif_frame_code_t* source = keep_alive ? raspdif.cache.noise : raspdif.cache.silence;
+  memory_copy_uncached(raspdif_buffer(v_control, buffer_index), source, raspdif.buffer.size * sizeof(spdif_frame_code_t));
+
+  // Pause so the DMA can't pass the end of the idle buffer while the link is changed
+  bcm283x_dma_enable(raspdif.dma_channel, false);
+
+  uint32_t offset = raspdif_dma_idle_position() + margin;
+  bool ahead = raspdif_dma_in_idle() && offset < RASPDIF_IDLE_SIZE;
+  if (ahead)
+    bcm283x_dma_set_next_control_block(raspdif.dma_channel, &b_control->control_blocks[buffer_index]);
+
+  bcm283x_dma_enable(raspdif.dma_channel, true);
+
+  if (!ahead)
+    return;
+
+  // Loop must not repeat should the DMA reload it
+  v_control->idle_loop.next_control_block = PTR32_CAST(&b_control->control_blocks[buffer_index]);
+  raspdif.idle.exiting = true;
+
+  // Idle buffer starts on a block boundary so its index is also the frame phase
+  raspdif.idle.write_ahead = true;
+  raspdif.idle.dirty = true;
+  raspdif.encoder.buffer_offset = offset;
+  raspdif.encoder.frame_index = offset % SPDIF_FRAME_COUNT;
+
+  LOGD(TAG, "Writing ahead from sample %d of idle buffer.", offset);
+}
+
+/**
+  @brief  Stop writing ahead if the DMA has caught up with the encoder or
+          left the idle loop. Audio continues in the buffer after the loop
+
+  @param  none
+  @retval none
+*/
+static void raspdif_idle_check_write_ahead()
+{
+  if (!raspdif.idle.write_ahead)
+    return;
+
+  if (raspdif_dma_in_idle() && raspdif_dma_idle_position() < raspdif.encoder.buffer_offset)
+    return;
+
+  LOGD(TAG, "DMA caught up with write-ahead.");
+
+  raspdif.idle.write_ahead = false;
+  raspdif.encoder.buffer_offset = 0;
+  raspdif.encoder.frame_index = 0;
+}
+
+/**
+  @brief  Prepare to leave the idle loop. The ring is restored and audio is written
+          ahead of the DMA in the idle buffer if possible, otherwise the buffer
+          after the idle entry point will be filled from the start of a block
+
+  @param  sample_rate Sample rate to convert the write-ahead margin to frames
+  @param  keep_alive Transmit quiet white noise to keep equipment alive
+  @retval uint8_t - Index of next buffer to fill
+*/
+static uint8_t raspdif_idle_resume(double sample_rate, bool keep_alive)
+{
+  uint8_t buffer_index = (raspdif.idle.buffer_index + 1) % raspdif.buffer.count;
+
+  // DMA is past the entry point so restore the ring
+  raspdif.control.virtual->control_blocks[raspdif.idle.buffer_index].next_control_block = PTR32_CAST(&raspdif.control.bus->control_blocks[buffer_index]);
+
+  // Idle loop always ends on a block boundary
+  raspdif.encoder.frame_index = 0;
+
+  // A partial buffer was linked between passes of the loop, let it play out
+  if (!raspdif.idle.exiting)
+    raspdif_idle_write_ahead(buffer_index, sample_rate, keep_alive);
+
+  return buffer_index;
+}
+
+/**
+  @brief  Link the idle loop back to the ring once the first buffer after it is full
+
+  @param  buffer_index Index of the buffer which is now full
+  @retval none
+*/
+static void raspdif_idle_exit(uint8_t buffer_index)
+{
+  if (!raspdif.idle.entered || raspdif.idle.exiting)
+    return;
+
+  assert(buffer_index == (raspdif.idle.buffer_index + 1) % raspdif.buffer.count);
+
+  raspdif.control.virtual->idle_loop.next_control_block = PTR32_CAST(&raspdif.control.bus->control_blocks[buffer_index]);
+  raspdif.idle.exiting = true;
+}
+
+/**
+  @brief  Restart fill level tracking after the ring was drained or refilled.
+          The learned correction is kept since the producer's rate hasn't changed
+
+  @param  none
+  @retval none
+*/
+static void raspdif_trim_reset()
+{
+  raspdif.trim.settle = 1;
+  raspdif.trim.sum = 0;
+  raspdif.trim.samples = 0;
+  clock_gettime(CLOCK_MONOTONIC, &raspdif.trim.start);
+}
+
+/**
+  @brief  Track the queued audio and nudge the PCM clock divisor so the output
+          rate follows the producer's
+
+  @param  queued Frames queued in the input and the DMA ring, at the input rate
+  @param  sample_rate Input sample rate in Hertz
+  @retval none
+*/
+static void raspdif_trim_update(uint32_t queued, double sample_rate)
+{
+  if (!raspdif.trim.enabled)
+    return;
+
+  // Average over the interval to hide the sawtooth of buffers filling and draining
+  raspdif.trim.sum += queued;
+  raspdif.trim.samples++;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  double elapsed = (now.tv_sec - raspdif.trim.start.tv_sec) + (now.tv_nsec - raspdif.trim.start.tv_nsec) / 1e9;
+  if (elapsed * 1000 < RASPDIF_TRIM_INTERVAL_MS)
+    return;
+
+  double level = raspdif.trim.sum / raspdif.trim.samples;
+
+  raspdif.trim.sum = 0;
+  raspdif.trim.samples = 0;
+  raspdif.trim.start = now;
+
+  // Skip the interval where the ring was filling, then hold the level reached
+  if (raspdif.trim.settle > 0)
+  {
+    if (--raspdif.trim.settle == 0)
+    {
+      raspdif.trim.setpoint = level;
+      LOGD(TAG, "Holding fill level of %g frames.", level);
+    }
+    return;
+  }
+
+  // A growing backlog means the producer is faster, so speed up
+  double error_ms = 1000 * (level - raspdif.trim.setpoint) / sample_rate;
+  raspdif.trim.integral += error_ms;
+
+  // Clamp the integral to prevent windup at the correction limit
+  double limit = RASPDIF_TRIM_MAX_PPM / RASPDIF_TRIM_KI;
+  raspdif.trim.integral = MAX(-limit, MIN(raspdif.trim.integral, limit));
+
+  double ppm = RASPDIF_TRIM_KP * error_ms + RASPDIF_TRIM_KI * raspdif.trim.integral;
+  ppm = MAX(-RASPDIF_TRIM_MAX_PPM, MIN(ppm, RASPDIF_TRIM_MAX_PPM));
+
+  double divisor = raspdif.clock.divisor / (1 + ppm * 1e-6);
+
+  double divi = 0;
+  double divf = round(4096 * modf(divisor, &divi));
+  if (divf >= 4096)
+  {
+    divi += 1;
+    divf = 0;
+  }
+
+  // Only write the divisor when the change is representable
+  if (divi == raspdif.clock.config.divi && divf == raspdif.clock.config.divf)
+    return;
+
+  raspdif.clock.config.divi = divi;
+  raspdif.clock.config.divf = divf;
+  raspdif.trim.ppm = ppm;
+
+  bcm283x_clock_set_divisor(clock_peripheral_pcm, divi, divf);
+
+  LOGD(TAG, "Fill error %.3f ms. Trimmed clock by %.1f ppm.", error_ms, ppm);
+}
+
+/**
+  @brief  Get the PCM DREQ thresholds and DMA burst length suited to a sample rate
+
+  @param  sample_rate Audio sample rate in Hertz
+  @retval raspdif_bus_config_t
+*/
+static raspdif_bus_config_t raspdif_default_bus_config(double sample_rate)
+{
+  // Higher rates drain the FIFO faster, so request earlier with a deeper panic
+  // margin and move more words per burst to reduce bus arbitration
+  if (sample_rate > 96e3)
+    return (raspdif_bus_config_t){.threshold = 48, .panic = 32, .burst = 8};
+
+  if (sample_rate > 48e3)
+    return (raspdif_bus_config_t){.threshold = 40, .panic = 24, .burst = 4};
+
+  return (raspdif_bus_config_t){.threshold = 32, .panic = 16, .burst = 1};
+}
+
+/**
+  @brief  Fill in the bus settings which weren't specified with the defaults for a sample rate
+
+  @param  sample_rate Audio sample rate in Hertz
+  @param  overrides Bus settings from arguments. Zero fields take the default
+  @param  bus Set to the resolved settings
+  @retval bool - Settings fit within the PCM FIFO
+*/
+static bool raspdif_resolve_bus_config(double sample_rate, const raspdif_bus_config_t* overrides, raspdif_bus_config_t* bus)
+{
+  *bus = raspdif_default_bus_config(sample_rate);
+  if (overrides->threshold)
+    bus->threshold = overrides->threshold;
+  if (overrides->panic)
+    bus->panic = overrides->panic;
+  if (overrides->burst)
+    bus->burst = overrides->burst;
+
+  if (bus->panic >= bus->threshold)
+  {
+    LOGE(TAG, "Panic threshold must be below the DREQ threshold.");
+    return false;
+  }
+
+  // DREQ is only sampled between bursts so a whole burst must fit in the FIFO
+  if (bus->threshold + bus->burst > RASPDIF_PCM_FIFO_SIZE)
+  {
+    LOGE(TAG, "DREQ threshold plus burst must not exceed %d words.", RASPDIF_PCM_FIFO_SIZE);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+  @brief  Apply new bus settings to the running DMA and PCM. Control blocks
+          are updated in place since the DMA reloads them on each pass
+
+  @param  bus PCM DREQ thresholds and DMA burst length
+  @retval none
+*/
+static void raspdif_configure_bus(const raspdif_bus_config_t* bus)
+{
+  raspdif.bus = *bus;
+
+  raspdif_control_t* v_control = raspdif.control.virtual;
+  for (size_t i = 0; i < raspdif.buffer.count; i++)
+    v_control->control_blocks[i].transfer_information.BURST_LENGTH = bus->burst - 1;
+
+  v_control->idle_lead_in.transfer_information.BURST_LENGTH = bus->burst - 1;
+  v_control->idle_loop.transfer_information.BURST_LENGTH = bus->burst - 1;
+
+  pcm_dma_config_t dma_config;
+  memset(&dma_config, 0, sizeof(pcm_dma_config_t));
+
+  dma_config.tx_threshold = bus->threshold;
+  dma_config.tx_panic = bus->panic;
+  bcm283x_pcm_configure_dma(true, &dma_config);
+
+  LOGD(TAG, "DREQ threshold %d, panic %d, burst %d words.", bus->threshold, bus->panic, bus->burst);
+}
+
+/**
+  @brief  Rescale everything timed in input frames for a new input rate
+
+  @param  input_rate Input sample rate in Hertz
+  @retval none
+*/
+static void raspdif_set_input_rate(double input_rate)
+{
+  uint32_t ramp_frames = RASPDIF_DUCK_RAMP_MS * input_rate / 1000;
+  raspdif.mix.hold_frames = RASPDIF_DUCK_HOLD_MS * input_rate / 1000;
+  for (uint8_t i = 0; i < raspdif.mix.count; i++)
+    mix_gain_set_ramp(&raspdif.mix.sources[i].gain, ramp_frames);
+
+  if (raspdif.volume.enabled)
+    mix_gain_set_ramp(&raspdif.volume.gain, RASPDIF_VOLUME_RAMP_MS * input_rate / 1000);
+}
+
+/**
+  @brief  Apply pending rate and format changes. The ring must be drained into the
+          idle loop so queued audio plays out at the old rate. The clock
+          divisor, channel status, pre-encoded fills, ramps and bus settings
+          follow the new rate
+
+  @param  arguments Arguments holding the current rate and format
+  @param  block SPDIF block to update the channel status of
+  @retval bool - Rate or format changed
+*/
+static bool raspdif_command_apply(raspdif_arguments_t* arguments, spdif_block_t* block)
+{
+  if (raspdif.command.count == 0)
+    return false;
+
+  double sample_rate = arguments->sample_rate;
+  double input_rate = arguments->input_rate;
+  raspdif_format_t format = arguments->format;
+
+  // Wait for queued audio to play out
+  raspdif_wait_dma_idle(true, sample_rate);
+
+  const char* replies[RASPDIF_MAX_PENDING_COMMANDS];
+  for (uint8_t i = 0; i < raspdif.command.count; i++)
+  {
+    const control_command_t* command = &raspdif.command.pending[i];
+    replies[i] = "ok";
+
+    switch (command->type)
+    {
+      case control_command_rate:
+      {
+        // Resampled output stays at a fixed rate. Otherwise reconfigure the clock
+        // Each request is applied so failures are reported to their sender
+        bool supported = true;
+        if (command->rate != input_rate && raspdif.resample.enabled)
+          supported = raspdif_resample_init(command->rate, sample_rate, format);
+        else if (command->rate != input_rate)
+          supported = raspdif_configure_clock(command->rate);
+
+        if (!supported)
+        {
+          LOGW(TAG, "Unsupported sample rate of %g Hz.", command->rate);
+          replies[i] = "error unsupported rate";
+          continue;
+        }
+
+        input_rate = command->rate;
+        if (!raspdif.resample.enabled)
+          sample_rate = input_rate;
+        break;
+      }
+
+      case control_command_format:
+        // Resampler clamps to the sample depth
+        if (command->format != format && raspdif.resample.enabled)
+          raspdif_resample_init(input_rate, sample_rate, command->format);
+
+        format = command->format;
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  bool changed = (input_rate != arguments->input_rate || format != arguments->format);
+  if (changed)
+  {
+    // Rebuild channel status and everything pre-encoded with it
+    spdif_populate_channel_status(block, sample_rate, raspdif_sample_depth(format));
+    raspdif_build_cache(block, format);
+    raspdif_build_idle(arguments->keep_alive);
+
+    // Drop any partial frame and restart each ring at offset 0 so frames of the new size never straddle its end
+    // The shared memory ring is reset with its format so producers can be fenced off
+    if (format != arguments->format)
+    {
+      input_reset(&raspdif.input);
+      for (uint8_t i = 1; i < raspdif.mix.count; i++)
+        input_reset(raspdif.mix.sources[i].input);
+    }
+
+    input_set_shm_format(&raspdif.input, (format == raspdif_format_s24le) ? raspdif_shm_format_s24le : raspdif_shm_format_s16le, input_rate);
+
+    // Producer has changed so its clock must be learned again
+    if (raspdif.trim.enabled)
+    {
+      raspdif.trim.integral = 0;
+      raspdif_trim_reset();
+    }
+
+    // Ramps and holds are counted in input frames
+    if (input_rate != arguments->input_rate)
+      raspdif_set_input_rate(input_rate);
+
+    // DMA is idle so the FIFO thresholds and burst can follow the hardware rate
+    if (sample_rate != arguments->sample_rate)
+    {
+      raspdif_bus_config_t bus;
+      if (raspdif_resolve_bus_config(sample_rate, &arguments->bus, &bus))
+        raspdif_configure_bus(&bus);
+      else
+        LOGW(TAG, "Keeping bus settings for %g Hz.", arguments->sample_rate);
+    }
+
+    LOGI(TAG, "Switched to %g Hz %s.", input_rate, (format == raspdif_format_s24le) ? "s24le" : "s16le");
+
+    arguments->sample_rate = sample_rate;
+    arguments->input_rate = input_rate;
+    arguments->format = format;
+  }
+
+  // Reply once the switch is complete so producers can write in the new format
+  for (uint8_t i = 0; i < raspdif.command.count; i++)
+    control_reply(&raspdif.command.socket, &raspdif.command.pending[i], replies[i]);
+
+  raspdif.command.count = 0;
+
+  return changed;
+}
+
+/**
+  @brief  Callback function for POSIX signals
+
+  @param  signal Received POSIX signal
+  @retval none
+*/
+static void signal_handler(int32_t signal)
+{
+  LOGW(TAG, "Received signal %s (%d).", strsignal(signal), signal);
+
+  raspdif_shutdown();
+
+  // Terminate
+  exit(EXIT_SUCCESS);
+}
+
+/**
+  @brief  Register a handler for all POSIX signals
+          that would cause termination
 
   @param  none
   @retval none
@@ -412,17 +2075,13 @@ void register_signal_handler()
 
   sa.sa_handler = &signal_handler;
 
-  // Register fatal signal handlers
-  sigaction(SIGHUP, &sa, NULL);
-  sigaction(SIGINT, &sa, NULL);
-  sigaction(SIGQUIT, &sa, NULL);
+  // Register fatal signal handlers. Termination requests are handled by the event loop
   sigaction(SIGILL, &sa, NULL);
   sigaction(SIGABRT, &sa, NULL);
   sigaction(SIGFPE, &sa, NULL);
   sigaction(SIGSEGV, &sa, NULL);
   sigaction(SIGPIPE, &sa, NULL);
   sigaction(SIGALRM, &sa, NULL);
-  sigaction(SIGTERM, &sa, NULL);
   sigaction(SIGBUS, &sa, NULL);
 }
 
@@ -438,17 +2097,23 @@ int main(int argc, char* argv[])
   raspdif_arguments_t arguments;
   memset(&arguments, 0, sizeof(raspdif_arguments_t));
 
-  // Set default sample rate, format and keep-alive
+  // Set default sample rate, format, buffering and keep-alive
   arguments.sample_rate = RASPDIF_DEFAULT_SAMPLE_RATE;
   arguments.format = RASPDIF_DEFAULT_FORMAT;
+  arguments.buffer_count = RASPDIF_DEFAULT_BUFFER_COUNT;
+  arguments.buffer_size = RASPDIF_DEFAULT_BUFFER_SIZE;
+  arguments.dma_channel = dma_channel_max;
+  arguments.resample_quality = resample_quality_medium;
+  arguments.duck_db = RASPDIF_DEFAULT_DUCK_DB;
   arguments.keep_alive = true;
 
   // Parse command line args
   struct argp argp = {options, parse_opt, NULL, NULL};
   argp_parse(&argp, argc, argv, 0, 0, &arguments);
 
-  // Register signal handlers
+  // Register signal handlers and route termination requests to the event loop
   register_signal_handler();
+  raspdif_loop_init();
 
   // Increase logging level to debug if requested
   if (arguments.verbose)
@@ -458,45 +2123,141 @@ int main(int argc, char* argv[])
   LOGW(TAG, "64 bit support is experimental. Please report any issues.");
 #endif
 
+  // Hardware runs at the resampled rate while producers keep writing at --rate
+  arguments.input_rate = arguments.sample_rate;
+  if (arguments.resample_rate > 0)
+    arguments.sample_rate = arguments.resample_rate;
+
+  // Fill in bus settings which weren't specified
+  raspdif_bus_config_t bus;
+  if (!raspdif_resolve_bus_config(arguments.sample_rate, &arguments.bus, &bus))
+    LOGF(TAG, "Invalid bus settings.");
+
   // Initialize hardware and buffers
-  dma_channel_t dma_channel = bcm_host_is_model_pi4() ? dma_channel_5 : dma_channel_13;
-  raspdif_init(dma_channel, arguments.sample_rate);
+  raspdif_init(arguments.dma_channel, arguments.sample_rate, arguments.buffer_count, arguments.buffer_size, &bus, arguments.adaptive);
+
+  // Select SPDIF encoder, sample unpackers and uncached copy for this CPU
+  spdif_init(arguments.encoder);
+  sample_init();
+  memory_init();
+
+  // Commit staged samples with a second DMA channel if requested
+  if (arguments.dma_copy)
+    raspdif_copy_init();
+
+  // Convert input to the output rate if it differs
+  resample_select();
+  raspdif.resample.quality = arguments.resample_quality;
+  if (arguments.input_rate != arguments.sample_rate && !raspdif_resample_init(arguments.input_rate, arguments.sample_rate, arguments.format))
+    LOGF(TAG, "Unsupported resampling from %g Hz to %g Hz.", arguments.input_rate, arguments.sample_rate);
 
   // Allocate storage for a SPDIF block
   spdif_block_t block;
   memset(&block, 0, sizeof(block));
 
   // Populate each frame with channel status data
-  spdif_populate_channel_status(&block);
+  spdif_populate_channel_status(&block, arguments.sample_rate, raspdif_sample_depth(arguments.format));
+
+  // Pre-encode silence and keep-alive frames for underruns
+  raspdif_build_cache(&block, arguments.format);
+  raspdif_build_idle(arguments.keep_alive);
 
-  // Open the target file or stdin
-  FILE* file = NULL;
-  if (arguments.file)
-    file = fopen(arguments.file, "r+b"); // Open with writing to prevent EOF when FIFO is empty
+  // Open the shared memory ring, or the target file or stdin and start reading
+  bool opened = false;
+  if (arguments.shared_memory)
+    opened = input_open_shm(&raspdif.input, (arguments.format == raspdif_format_s24le) ? raspdif_shm_format_s24le : raspdif_shm_format_s16le, arguments.input_rate);
   else
-    file = freopen(NULL, "rb", stdin);
+    opened = input_open(&raspdif.input, arguments.file);
+
+  if (!opened)
+    LOGF(TAG, "Failed to open input.");
+
+  // Open inputs to mix with the primary input
+  if (arguments.mix_count > 0)
+  {
+    mix_init();
+
+    uint32_t ramp_frames = RASPDIF_DUCK_RAMP_MS * arguments.input_rate / 1000;
+    raspdif.mix.duck = mix_gain_from_db(arguments.duck_db);
+    raspdif.mix.hold_frames = RASPDIF_DUCK_HOLD_MS * arguments.input_rate / 1000;
+
+    raspdif.mix.sources[0].input = &raspdif.input;
+    mix_gain_init(&raspdif.mix.sources[0].gain, MIX_UNITY, ramp_frames);
+
+    for (uint8_t i = 0; i < arguments.mix_count; i++)
+    {
+      input_t* input = calloc(1, sizeof(input_t));
+      if (input == NULL || !input_open(input, arguments.mix[i]))
+        LOGF(TAG, "Failed to open input '%s' to mix.", arguments.mix[i]);
+
+      raspdif.mix.sources[i + 1].input = input;
+      raspdif.mix.sources[i + 1].priority = arguments.mix_priority[i];
+      mix_gain_init(&raspdif.mix.sources[i + 1].gain, MIX_UNITY, ramp_frames);
+
+      LOGI(TAG, "Mixing '%s' at priority %d.", arguments.mix[i], arguments.mix_priority[i]);
+    }
+
+    raspdif.mix.count = arguments.mix_count + 1;
+  }
+
+  // Accept rate, format and volume changes from players
+  if (arguments.control != NULL)
+  {
+    raspdif.command.enabled = control_open(&raspdif.command.socket, arguments.control);
+    if (!raspdif.command.enabled)
+      LOGF(TAG, "Failed to open control socket.");
+  }
+
+  // Scale samples when the volume is set or may be changed
+  if (arguments.volume_db < 0 || raspdif.command.enabled)
+  {
+    mix_init();
+
+    raspdif.volume.enabled = true;
+    mix_gain_init(&raspdif.volume.gain, mix_gain_from_db(arguments.volume_db), RASPDIF_VOLUME_RAMP_MS * arguments.input_rate / 1000);
+
+    LOGI(TAG, "Volume set to %g dB.", arguments.volume_db);
+  }
+
+  // Wake the loop when input or a command arrives or a termination is requested
+  raspdif_loop_watch(raspdif.loop.signal_fd);
+  raspdif_loop_watch(raspdif.loop.timer_fd);
+  raspdif_loop_watch(input_get_event_fd(&raspdif.input));
+
+  for (uint8_t i = 1; i < raspdif.mix.count; i++)
+    raspdif_loop_watch(input_get_event_fd(raspdif.mix.sources[i].input));
 
-  // Failed to open file
-  if (file == NULL)
-    LOGF(TAG, "Unable to open file. Error: %s.", strerror(errno));
+  if (raspdif.command.enabled)
+    raspdif_loop_watch(raspdif.command.socket.fd);
 
-  LOGI(TAG, "Estimated latency: %g seconds.", (RASPDIF_BUFFER_COUNT - 1) * (RASPDIF_BUFFER_SIZE / arguments.sample_rate));
+  LOGI(TAG, "Estimated latency: %g seconds.", (raspdif.buffer.count - 1) * (raspdif.buffer.size / arguments.sample_rate));
   LOGI(TAG, "Waiting for data...");
 
-  // Determine sample size in bytes
-  uint8_t sample_size = (arguments.format == raspdif_format_s24le) ? 3 : sizeof(int16_t);
+  // Determine frame size in bytes
+  uint8_t frame_size = raspdif_frame_size(arguments.format);
+
+  // Storage for a batch of parsed samples
+  int32_t scratch[RASPDIF_CHUNK_SIZE * 2];
+  const int32_t* samples = NULL;
 
   // Pre-load the buffers
   uint8_t buffer_index = 0;
-  uint8_t samples[2 * sizeof(int32_t)] = {0};
-  while (fread(samples, sample_size, 2, file) > 0 && buffer_index < RASPDIF_BUFFER_COUNT)
+  size_t count = 0;
+  while (buffer_index < raspdif.buffer.count && raspdif.loop.running)
   {
-    // Parse sample buffer in proper format
-    int32_t sample_a = raspdif_parse_sample(arguments.format, &samples[0]);
-    int32_t sample_b = raspdif_parse_sample(arguments.format, &samples[sample_size]);
+    count = raspdif_read_samples(arguments.format, scratch, raspdif_buffer_free(), &samples);
+    if (count == 0)
+    {
+      // Start with what we have if the stream ended
+      if (raspdif_input_ended(frame_size))
+        break;
+
+      raspdif_loop_wait(0);
+      continue;
+    }
 
-    raspdif_buffer_t* buffer = &raspdif.control.virtual->buffers[buffer_index];
-    bool full = raspdif_buffer_samples(buffer, &block, arguments.format, sample_a, sample_b);
+    spdif_frame_code_t* buffer = raspdif_buffer(raspdif.control.virtual, buffer_index);
+    bool full = raspdif_buffer_samples(buffer, &block, arguments.format, samples, count);
 
     if (full)
       buffer_index++;
@@ -508,29 +2269,79 @@ int main(int argc, char* argv[])
   bcm283x_dma_enable(raspdif.dma_channel, true);
   bcm283x_pcm_enable(true, false);
 
-  // Set stndin to nonblocking
-  fcntl(fileno(file), F_SETFL, O_NONBLOCK);
+  // Start measuring from a clean slate and report on a fixed period
+  if (arguments.stats)
+  {
+    raspdif.stats.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (raspdif.stats.timer_fd == -1)
+      LOGF(TAG, "Failed to create stats timer. Error: %s.", strerror(errno));
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = RASPDIF_STATS_INTERVAL_S;
+    spec.it_interval.tv_sec = RASPDIF_STATS_INTERVAL_S;
+    timerfd_settime(raspdif.stats.timer_fd, 0, &spec, NULL);
+    raspdif_loop_watch(raspdif.stats.timer_fd);
+
+    raspdif.stats.enabled = true;
+    bcm283x_pcm_check_transmit_error();
+    bcm283x_dma_check_errors(raspdif.dma_channel);
+  }
+
+  // Fill level of a mapped file says nothing about a producer's rate
+  if (arguments.adaptive && raspdif.input.mode == input_mode_map)
+    LOGW(TAG, "Adaptive rate ignored when playing a file.");
+  else if (arguments.adaptive)
+  {
+    raspdif.trim.enabled = true;
+    raspdif_trim_reset();
+  }
 
   // Reset to first buffer.
   buffer_index = 0;
 
-  // Read file until EOS. Note: files opened in r+ will not emit EOF
-  while (!feof(file))
+  // Read until EOS or terminated. Note: files opened for writing will not emit EOF
+  while (raspdif.loop.running)
   {
-    if (bcm283x_dma_get_control_block(raspdif.dma_channel) == &raspdif.control.bus->control_blocks[buffer_index])
+    raspdif_stats_update();
+
+    // Reap the copy started by the last commit
+    raspdif_copy_check(false);
+
+    // Fall back to the ring if the DMA reached the audio written ahead of it
+    raspdif_idle_check_write_ahead();
+
+    // Let shared memory producers know how much audio is queued
+    // Queued and resampled frames are at the output rate, while producers count input frames
+    uint32_t delay = raspdif_dma_delay(buffer_index);
+    if (raspdif.resample.enabled)
+      delay = (delay + raspdif.resample.count - raspdif.resample.offset) * arguments.input_rate / arguments.sample_rate;
+
+    input_publish_delay(&raspdif.input, delay);
+
+    // Follow the producer's rate while streaming
+    if (!raspdif.idle.entered)
+      raspdif_trim_update(delay + raspdif_input_frames(frame_size), arguments.input_rate);
+
+    if (raspdif_dma_on_buffer(buffer_index))
     {
-      // If DMA is using current buffer, delay by approx 1 buffer's duration
-      microsleep(1e6 * (RASPDIF_BUFFER_SIZE / arguments.sample_rate));
+      // If DMA is using current buffer, wake when it's predicted to finish
+      raspdif_loop_wait(raspdif_dma_remaining_us(arguments.sample_rate));
       continue;
     }
 
-    // If read fails (or would block) pause the stream
-    if (fread(samples, sample_size, 2, file) != 2 && !feof(file))
+    // Take as many whole frames as are ready in the ring
+    count = raspdif_read_samples(arguments.format, scratch, raspdif_buffer_free(), &samples);
+    if (count == 0)
     {
+      // Stream has ended. Any remainder is a partial frame
+      if (raspdif_input_ended(frame_size))
+        break;
+
       LOGD(TAG, "Buffer underrun.");
 
-      // Zero fill the sample buffers for silence
-      raspdif_fill_buffers(buffer_index, &block, arguments.format, arguments.sample_rate, arguments.keep_alive);
+      // Finish the current buffer and switch the DMA to the idle loop
+      raspdif_idle_enter(buffer_index, arguments.sample_rate, arguments.keep_alive);
 
       if (arguments.pcm_disable)
       {
@@ -538,11 +2349,12 @@ int main(int argc, char* argv[])
         LOGD(TAG, "PCM disabled.");
       }
 
-      // Wait for file to be readable
-      struct pollfd poll_list;
-      poll_list.fd = fileno(file);
-      poll_list.events = POLLIN;
-      poll(&poll_list, 1, -1);
+      // Switch rate or format while the ring is drained and wait for a frame to arrive
+      do
+      {
+        if (raspdif_command_apply(&arguments, &block))
+          frame_size = raspdif_frame_size(arguments.format);
+      } while (raspdif_input_frames(frame_size) == 0 && !raspdif_input_ended(frame_size) && raspdif_loop_wait(0));
 
       if (arguments.pcm_disable)
       {
@@ -550,25 +2362,52 @@ int main(int argc, char* argv[])
         LOGD(TAG, "PCM enabled.");
       }
 
+      // Refill the ring from the buffer after the idle loop
+      buffer_index = raspdif_idle_resume(arguments.sample_rate, arguments.keep_alive);
+
+      // Fill level starts over after an underrun
+      if (raspdif.trim.enabled)
+        raspdif_trim_reset();
+
       // Resume read loop
       LOGD(TAG, "Data available.");
       continue;
     }
 
-    // Parse sample buffer in proper format
-    int32_t sample_a = raspdif_parse_sample(arguments.format, &samples[0]);
-    int32_t sample_b = raspdif_parse_sample(arguments.format, &samples[sample_size]);
+    // Audio is written into the idle buffer ahead of the DMA while resuming
+    spdif_frame_code_t* buffer = raspdif.idle.write_ahead ? raspdif.control.virtual->idle.sample : raspdif_buffer(raspdif.control.virtual, buffer_index);
+    bool full = raspdif_buffer_samples(buffer, &block, arguments.format, samples, count);
 
-    raspdif_buffer_t* buffer = &raspdif.control.virtual->buffers[buffer_index];
-    bool full = raspdif_buffer_samples(buffer, &block, arguments.format, sample_a, sample_b);
+    if (full && raspdif.idle.write_ahead)
+    {
+      // Idle buffer ends on a block boundary, continue in the ring after it
+      raspdif.idle.write_ahead = false;
+    }
+    else if (full)
+    {
+      // Leave the idle loop if this buffer follows it
+      raspdif_idle_exit(buffer_index);
 
-    if (full)
-      buffer_index = (buffer_index + 1) % RASPDIF_BUFFER_COUNT;
+      buffer_index = (buffer_index + 1) % raspdif.buffer.count;
+    }
   }
 
   // TODO How do we wait until the end of the stream
 
   // Shutdown in a safe manner
+  if (raspdif.resample.enabled)
+    resample_release(&raspdif.resample.engine);
+
+  if (raspdif.command.enabled)
+    control_close(&raspdif.command.socket);
+
+  for (uint8_t i = 1; i < raspdif.mix.count; i++)
+  {
+    input_close(raspdif.mix.sources[i].input);
+    free(raspdif.mix.sources[i].input);
+  }
+
+  input_close(&raspdif.input);
   raspdif_shutdown();
 
   return 0;
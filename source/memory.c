@@ -7,9 +7,18 @@
 #include "log.h"
 #include "mailbox.h"
 #include "memory.h"
+#include "utils.h"
 
 #define TAG "Memory"
 
+typedef struct memory_burst_t
+{
+  uint64_t word[MEMORY_BURST_SIZE / sizeof(uint64_t)];
+} memory_burst_t;
+
+// Copier selected at init
+static memory_copier_t memory_copy_uncached_impl = memory_copy_uncached_scalar;
+
 /**
   @brief  Map physical memory located at offset into the virtual memory space
 
@@ -64,6 +73,37 @@ void* memory_allocate_virtual(size_t length)
   return virtual;
 }
 
+/**
+  @brief  Look up the physical address backing a locked virtual address via pagemap
+
+  @param  virtual Address in virtual space. Page must be present
+  @retval off_t - Physical address. -1 on failure
+*/
+off_t memory_virtual_to_physical(const void* virtual)
+{
+  int32_t file = open("/proc/self/pagemap", O_RDONLY);
+  if (file == -1)
+  {
+    LOGE(TAG, "Failed to open pagemap. Error: %s", strerror(errno));
+    return -1;
+  }
+
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  off_t index = ((uintptr_t)virtual / page_size) * sizeof(pagemap_entry_t);
+
+  pagemap_entry_t entry;
+  ssize_t result = pread(file, &entry, sizeof(entry), index);
+  close(file);
+
+  if (result != sizeof(entry) || !entry.present || entry.pfn == 0)
+  {
+    LOGE(TAG, "Failed to find physical page of 0x%X.", virtual);
+    return -1;
+  }
+
+  return (off_t)entry.pfn * page_size + ((uintptr_t)virtual % page_size);
+}
+
 /**
   @brief  Allocate & lock physical memory via the VideoCore
 
@@ -122,3 +162,65 @@ int32_t memory_release_physical(const memory_physical_t* memory)
 
   return 0;
 }
+
+/**
+  @brief  Copy into uncached memory in bursts of whole words so each bus
+          transaction moves as much data as possible
+
+  @param  destination Uncached destination. Must be 8 byte aligned
+  @param  source Cached source. Must be 8 byte aligned
+  @param  length Number of bytes to copy. Must be a multiple of 8
+  @retval none
+*/
+void memory_copy_uncached_scalar(void* destination, const void* source, size_t length)
+{
+  assert(((uintptr_t)destination & 0x7) == 0 && ((uintptr_t)source & 0x7) == 0);
+  assert(length % sizeof(uint64_t) == 0);
+
+  memory_burst_t* burst_destination = destination;
+  const memory_burst_t* burst_source = source;
+
+  size_t bursts = length / sizeof(memory_burst_t);
+  for (size_t i = 0; i < bursts; i++)
+    burst_destination[i] = burst_source[i];
+
+  // Copy remainder
+  uint64_t* word_destination = (uint64_t*)&burst_destination[bursts];
+  const uint64_t* word_source = (const uint64_t*)&burst_source[bursts];
+  for (size_t i = 0; i < (length % sizeof(memory_burst_t)) / sizeof(uint64_t); i++)
+    word_destination[i] = word_source[i];
+}
+
+/**
+  @brief  Select the fastest uncached copy supported by this CPU
+
+  @param  none
+  @retval none
+*/
+void memory_init()
+{
+#if defined(RASPDIF_NEON)
+  if (neon_supported())
+  {
+    memory_copy_uncached_impl = memory_copy_uncached_neon;
+
+    LOGD(TAG, "Using NEON uncached copy.");
+    return;
+  }
+#endif
+
+  LOGD(TAG, "Using scalar uncached copy.");
+}
+
+/**
+  @brief  Copy a block from cached memory into uncached memory such as DMA buffers
+
+  @param  destination Uncached destination. Must be 8 byte aligned
+  @param  source Cached source. Must be 8 byte aligned
+  @param  length Number of bytes to copy. Must be a multiple of 8
+  @retval none
+*/
+void memory_copy_uncached(void* destination, const void* source, size_t length)
+{
+  memory_copy_uncached_impl(destination, source, length);
+}
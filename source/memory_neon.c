@@ -0,0 +1,38 @@
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+
+#include "memory.h"
+
+/**
+  @brief  Copy into uncached memory 64 bytes at a time with NEON. Doubleword
+          elements keep each store a full width access to the uncached mapping
+
+  @param  destination Uncached destination. Must be 8 byte aligned
+  @param  source Cached source. Must be 8 byte aligned
+  @param  length Number of bytes to copy. Must be a multiple of 8
+  @retval none
+*/
+void memory_copy_uncached_neon(void* destination, const void* source, size_t length)
+{
+  uint64_t* d = destination;
+  const uint64_t* s = source;
+
+  size_t count = length / sizeof(uint64_t);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    uint64x2_t q0 = vld1q_u64(&s[i]);
+    uint64x2_t q1 = vld1q_u64(&s[i + 2]);
+    uint64x2_t q2 = vld1q_u64(&s[i + 4]);
+    uint64x2_t q3 = vld1q_u64(&s[i + 6]);
+
+    vst1q_u64(&d[i], q0);
+    vst1q_u64(&d[i + 2], q1);
+    vst1q_u64(&d[i + 4], q2);
+    vst1q_u64(&d[i + 6], q3);
+  }
+
+  // Copy remainder
+  memory_copy_uncached_scalar(&d[i], &s[i], (count - i) * sizeof(uint64_t));
+}
+#endif
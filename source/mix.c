@@ -0,0 +1,259 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <sys/param.h>
+
+#include "log.h"
+#include "mix.h"
+#include "utils.h"
+
+#define TAG "Mix"
+
+// Kernels selected at init
+static mix_accumulator_t mix_accumulate_impl = mix_accumulate_scalar;
+static mix_scaler_t mix_scale_impl = mix_scale_scalar;
+static mix_clamper_t mix_clamp_impl = mix_clamp_scalar;
+
+/**
+  @brief  Multiply a sample by a Q31 gain with rounding
+
+  @param  sample Sample
+  @param  gain Q31 gain
+  @retval int32_t
+*/
+static inline int32_t mix_scale_sample(int32_t sample, int32_t gain)
+{
+  return ((int64_t)sample * gain + (1LL << 30)) >> 31;
+}
+
+/**
+  @brief  Add stereo frames scaled by a gain to an accumulator
+
+  @param  accumulator Interleaved samples to add to
+  @param  samples Interleaved samples to add
+  @param  frames Number of stereo frames
+  @param  gain Q31 gain of the first frame
+  @param  step Change in gain for each following frame
+  @retval none
+*/
+void mix_accumulate_scalar(int32_t* accumulator, const int32_t* samples, size_t frames, int32_t gain, int32_t step)
+{
+  for (size_t i = 0; i < frames; i++)
+  {
+    int32_t g = gain + step * (int32_t)i;
+    accumulator[2 * i] += mix_scale_sample(samples[2 * i], g);
+    accumulator[2 * i + 1] += mix_scale_sample(samples[2 * i + 1], g);
+  }
+}
+
+/**
+  @brief  Scale stereo frames in place by a gain
+
+  @param  samples Interleaved samples to scale
+  @param  frames Number of stereo frames
+  @param  gain Q31 gain of the first frame
+  @param  step Change in gain for each following frame
+  @retval none
+*/
+void mix_scale_scalar(int32_t* samples, size_t frames, int32_t gain, int32_t step)
+{
+  for (size_t i = 0; i < frames; i++)
+  {
+    int32_t g = gain + step * (int32_t)i;
+    samples[2 * i] = mix_scale_sample(samples[2 * i], g);
+    samples[2 * i + 1] = mix_scale_sample(samples[2 * i + 1], g);
+  }
+}
+
+/**
+  @brief  Clamp samples to a range
+
+  @param  samples Samples to clamp
+  @param  count Number of samples
+  @param  min Minimum value
+  @param  max Maximum value
+  @retval none
+*/
+void mix_clamp_scalar(int32_t* samples, size_t count, int32_t min, int32_t max)
+{
+  for (size_t i = 0; i < count; i++)
+    samples[i] = MAX(min, MIN(samples[i], max));
+}
+
+/**
+  @brief  Select the fastest kernels supported by this CPU
+
+  @param  none
+  @retval none
+*/
+void mix_init()
+{
+#if defined(RASPDIF_NEON)
+  if (neon_supported())
+  {
+    mix_accumulate_impl = mix_accumulate_neon;
+    mix_scale_impl = mix_scale_neon;
+    mix_clamp_impl = mix_clamp_neon;
+
+    LOGD(TAG, "Using NEON mixer.");
+    return;
+  }
+#endif
+
+  LOGD(TAG, "Using scalar mixer.");
+}
+
+/**
+  @brief  Convert an attenuation or amplification in decibels to a Q31 gain
+
+  @param  db Gain in decibels. Clamped to unity
+  @retval int32_t - Q31 gain
+*/
+int32_t mix_gain_from_db(double db)
+{
+  if (db >= 0)
+    return MIX_UNITY;
+
+  return lround(pow(10, db / 20) * MIX_UNITY);
+}
+
+/**
+  @brief  Initialize a ramped gain
+
+  @param  gain Gain to initialize
+  @param  value Initial Q31 gain
+  @param  ramp_frames Frames a ramp across the full range takes
+  @retval none
+*/
+void mix_gain_init(mix_gain_t* gain, int32_t value, uint32_t ramp_frames)
+{
+  assert(gain != NULL);
+
+  gain->current = value;
+  gain->target = value;
+  mix_gain_set_ramp(gain, ramp_frames);
+}
+
+/**
+  @brief  Change the duration of ramps without disturbing the current gain
+
+  @param  gain Gain to update
+  @param  ramp_frames Frames a ramp across the full range takes
+  @retval none
+*/
+void mix_gain_set_ramp(mix_gain_t* gain, uint32_t ramp_frames)
+{
+  assert(gain != NULL);
+
+  gain->step = MAX(1, MIX_UNITY / MAX(1, ramp_frames));
+}
+
+/**
+  @brief  Start ramping toward a new gain
+
+  @param  gain Gain to update
+  @param  target Q31 gain to ramp to
+  @retval none
+*/
+void mix_gain_set(mix_gain_t* gain, int32_t target)
+{
+  assert(gain != NULL);
+  assert(target >= 0);
+
+  gain->target = target;
+}
+
+/**
+  @brief  Advance a ramped gain over the next run of frames with a constant step
+
+  @param  gain Ramped gain. Advanced by the returned number of frames
+  @param  frames Number of frames remaining
+  @param  start Set to the Q31 gain of the first frame of the run
+  @param  step Set to the change in gain for each following frame
+  @retval size_t - Number of frames in the run
+*/
+static size_t mix_gain_advance(mix_gain_t* gain, size_t frames, int32_t* start, int32_t* step)
+{
+  *start = gain->current;
+  *step = 0;
+
+  if (gain->current == gain->target)
+    return frames;
+
+  // Ramp until the target is reached, never passing it
+  int64_t distance = (int64_t)gain->target - gain->current;
+  size_t ramp = MIN(frames, (size_t)((llabs(distance) + gain->step - 1) / gain->step));
+  *step = (distance > 0) ? gain->step : -gain->step;
+
+  int64_t current = gain->current + (int64_t)*step * ramp;
+  gain->current = (distance > 0) ? MIN(current, gain->target) : MAX(current, gain->target);
+
+  return ramp;
+}
+
+/**
+  @brief  Add stereo frames scaled by a ramped gain to an accumulator
+
+  @param  accumulator Interleaved samples to add to
+  @param  samples Interleaved samples to add
+  @param  frames Number of stereo frames
+  @param  gain Ramped gain. Advanced by the number of frames
+  @retval none
+*/
+void mix_accumulate(int32_t* accumulator, const int32_t* samples, size_t frames, mix_gain_t* gain)
+{
+  assert(gain != NULL);
+
+  while (frames > 0)
+  {
+    int32_t start = 0;
+    int32_t step = 0;
+    size_t count = mix_gain_advance(gain, frames, &start, &step);
+
+    mix_accumulate_impl(accumulator, samples, count, start, step);
+
+    accumulator += 2 * count;
+    samples += 2 * count;
+    frames -= count;
+  }
+}
+
+/**
+  @brief  Scale stereo frames in place by a ramped gain. Samples are left
+          untouched while the gain rests at unity
+
+  @param  samples Interleaved samples to scale
+  @param  frames Number of stereo frames
+  @param  gain Ramped gain. Advanced by the number of frames
+  @retval none
+*/
+void mix_scale(int32_t* samples, size_t frames, mix_gain_t* gain)
+{
+  assert(gain != NULL);
+
+  while (frames > 0)
+  {
+    int32_t start = 0;
+    int32_t step = 0;
+    size_t count = mix_gain_advance(gain, frames, &start, &step);
+
+    if (start != MIX_UNITY || step != 0)
+      mix_scale_impl(samples, count, start, step);
+
+    samples += 2 * count;
+    frames -= count;
+  }
+}
+
+/**
+  @brief  Clamp mixed samples to the range of a sample depth
+
+  @param  samples Samples to clamp
+  @param  count Number of samples
+  @param  bits Sample depth
+  @retval none
+*/
+void mix_clamp(int32_t* samples, size_t count, uint8_t bits)
+{
+  mix_clamp_impl(samples, count, -(1 << (bits - 1)), (1 << (bits - 1)) - 1);
+}
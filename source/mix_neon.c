@@ -0,0 +1,97 @@
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+
+#include "mix.h"
+
+/**
+  @brief  Add stereo frames scaled by a gain to an accumulator, 2 frames at a time with NEON
+
+  @param  accumulator Interleaved samples to add to
+  @param  samples Interleaved samples to add
+  @param  frames Number of stereo frames
+  @param  gain Q31 gain of the first frame
+  @param  step Change in gain for each following frame
+  @retval none
+*/
+void mix_accumulate_neon(int32_t* accumulator, const int32_t* samples, size_t frames, int32_t gain, int32_t step)
+{
+  // Each lane pair holds the gain of one frame. Lanes past the end of a ramp
+  // may wrap but are never used
+  int32_t next = (uint32_t)gain + (uint32_t)step;
+  const int32_t initial[4] = {gain, gain, next, next};
+  int32x4_t g = vld1q_s32(initial);
+  int32x4_t increment = vdupq_n_s32(2 * (uint32_t)step);
+
+  size_t i = 0;
+  for (; i + 2 <= frames; i += 2)
+  {
+    int32x4_t x = vld1q_s32(&samples[2 * i]);
+    int32x4_t a = vld1q_s32(&accumulator[2 * i]);
+
+    // Rounding doubling multiply high is a rounded Q31 multiply
+    vst1q_s32(&accumulator[2 * i], vaddq_s32(a, vqrdmulhq_s32(x, g)));
+
+    g = vaddq_s32(g, increment);
+  }
+
+  // Accumulate remainder
+  mix_accumulate_scalar(&accumulator[2 * i], &samples[2 * i], frames - i, gain + step * (int32_t)i, step);
+}
+
+/**
+  @brief  Scale stereo frames in place by a gain, 2 frames at a time with NEON
+
+  @param  samples Interleaved samples to scale
+  @param  frames Number of stereo frames
+  @param  gain Q31 gain of the first frame
+  @param  step Change in gain for each following frame
+  @retval none
+*/
+void mix_scale_neon(int32_t* samples, size_t frames, int32_t gain, int32_t step)
+{
+  int32_t next = (uint32_t)gain + (uint32_t)step;
+  const int32_t initial[4] = {gain, gain, next, next};
+  int32x4_t g = vld1q_s32(initial);
+  int32x4_t increment = vdupq_n_s32(2 * (uint32_t)step);
+
+  size_t i = 0;
+  for (; i + 2 <= frames; i += 2)
+  {
+    int32x4_t x = vld1q_s32(&samples[2 * i]);
+    vst1q_s32(&samples[2 * i], vqrdmulhq_s32(x, g));
+
+    g = vaddq_s32(g, increment);
+  }
+
+  // Scale remainder
+  mix_scale_scalar(&samples[2 * i], frames - i, gain + step * (int32_t)i, step);
+}
+
+/**
+  @brief  Clamp samples to a range, 8 at a time with NEON
+
+  @param  samples Samples to clamp
+  @param  count Number of samples
+  @param  min Minimum value
+  @param  max Maximum value
+  @retval none
+*/
+void mix_clamp_neon(int32_t* samples, size_t count, int32_t min, int32_t max)
+{
+  int32x4_t lower = vdupq_n_s32(min);
+  int32x4_t upper = vdupq_n_s32(max);
+
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    int32x4_t a = vld1q_s32(&samples[i]);
+    int32x4_t b = vld1q_s32(&samples[i + 4]);
+
+    vst1q_s32(&samples[i], vminq_s32(vmaxq_s32(a, lower), upper));
+    vst1q_s32(&samples[i + 4], vminq_s32(vmaxq_s32(b, lower), upper));
+  }
+
+  // Clamp remainder
+  mix_clamp_scalar(&samples[i], count - i, min, max);
+}
+#endif
@@ -0,0 +1,292 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "log.h"
+#include "resample.h"
+#include "utils.h"
+
+#define TAG "Resample"
+
+// Filter selected at init
+static resample_filter_t resample_filter = resample_filter_scalar;
+
+/**
+  @brief  Filter a stereo output frame as the dot product of one phase of
+          coefficients with each channel's history
+
+  @param  coefficients Time reversed coefficients of the phase
+  @param  left History of the left channel at the window start
+  @param  right History of the right channel at the window start
+  @param  taps Number of coefficients
+  @param  output Left and right accumulators scaled by the coefficient format
+  @retval none
+*/
+void resample_filter_scalar(const int32_t* coefficients, const int32_t* left, const int32_t* right, size_t taps, int64_t* output)
+{
+  int64_t l = 0;
+  int64_t r = 0;
+  for (size_t i = 0; i < taps; i++)
+  {
+    l += (int64_t)coefficients[i] * left[i];
+    r += (int64_t)coefficients[i] * right[i];
+  }
+
+  output[0] = l;
+  output[1] = r;
+}
+
+/**
+  @brief  Select the fastest filter supported by this CPU
+
+  @param  none
+  @retval none
+*/
+void resample_select()
+{
+#if defined(RASPDIF_NEON)
+  if (neon_supported())
+  {
+    resample_filter = resample_filter_neon;
+
+    LOGD(TAG, "Using NEON resampling filter.");
+    return;
+  }
+#endif
+
+  LOGD(TAG, "Using scalar resampling filter.");
+}
+
+/**
+  @brief  Zeroth order modified Bessel function of the first kind
+
+  @param  x
+  @retval double
+*/
+static double resample_bessel_i0(double x)
+{
+  double sum = 1;
+  double term = 1;
+  for (uint32_t k = 1; k < 32; k++)
+  {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+
+  return sum;
+}
+
+/**
+  @brief  Greatest common divisor
+
+  @param  a
+  @param  b
+  @retval uint32_t
+*/
+static uint32_t resample_gcd(uint32_t a, uint32_t b)
+{
+  while (b != 0)
+  {
+    uint32_t t = a % b;
+    a = b;
+    b = t;
+  }
+
+  return a;
+}
+
+/**
+  @brief  Design a Kaiser windowed sinc low pass and split it into phases
+
+  @param  resample Resampler with factors and taps set
+  @param  beta Kaiser window shape
+  @param  rolloff Cutoff as a fraction of the lower Nyquist frequency
+  @retval none
+*/
+static void resample_design(resample_t* resample, double beta, double rolloff)
+{
+  uint32_t length = resample->up * resample->taps;
+  double center = (length - 1) / 2.0;
+
+  // Cutoff in cycles per input sample, relative to the input Nyquist frequency
+  double cutoff = rolloff * MIN(1.0, (double)resample->up / resample->down);
+
+  for (uint32_t phase = 0; phase < resample->up; phase++)
+  {
+    int32_t* coefficients = &resample->coefficients[phase * resample->taps];
+
+    double taps[resample->taps];
+    double sum = 0;
+    for (uint16_t k = 0; k < resample->taps; k++)
+    {
+      uint32_t n = phase + k * resample->up;
+
+      // Time from the filter center in input samples
+      double t = (n - center) / resample->up;
+      double x = M_PI * cutoff * t;
+      double sinc = (x == 0) ? 1 : sin(x) / x;
+
+      double r = (n - center) / center;
+      double window = resample_bessel_i0(beta * sqrt(MAX(0.0, 1 - r * r))) / resample_bessel_i0(beta);
+
+      taps[k] = cutoff * sinc * window;
+      sum += taps[k];
+    }
+
+    // Normalize each phase to unity gain so DC doesn't ripple between phases
+    // Store reversed so the filter runs forward through the history
+    for (uint16_t k = 0; k < resample->taps; k++)
+      coefficients[resample->taps - 1 - k] = lround(ldexp(taps[k] / sum, RESAMPLE_COEFF_BITS));
+  }
+}
+
+/**
+  @brief  Initialize a polyphase resampler between two rates
+
+  @param  resample Resampler to initialize
+  @param  input_rate Input sample rate in Hertz
+  @param  output_rate Output sample rate in Hertz
+  @param  quality Filter quality
+  @param  bits Sample depth to clamp output to
+  @retval bool - Rates are supported
+*/
+bool resample_init(resample_t* resample, uint32_t input_rate, uint32_t output_rate, resample_quality_t quality, uint8_t bits)
+{
+  assert(resample != NULL);
+  assert(input_rate > 0 && output_rate > 0);
+
+  memset(resample, 0, sizeof(resample_t));
+
+  uint32_t gcd = resample_gcd(input_rate, output_rate);
+  resample->up = output_rate / gcd;
+  resample->down = input_rate / gcd;
+
+  if (resample->up > RESAMPLE_MAX_PHASES)
+  {
+    LOGE(TAG, "Ratio of %u Hz to %u Hz requires %u phases. Max %d.", output_rate, input_rate, resample->up, RESAMPLE_MAX_PHASES);
+    return false;
+  }
+
+  if (resample->up > RESAMPLE_MAX_RATIO * resample->down)
+  {
+    LOGE(TAG, "Ratio of %u Hz to %u Hz exceeds %d.", output_rate, input_rate, RESAMPLE_MAX_RATIO);
+    return false;
+  }
+
+  double beta = 0;
+  double rolloff = 0;
+  switch (quality)
+  {
+    case resample_quality_low:
+      resample->taps = 16;
+      beta = 6;
+      rolloff = 0.85;
+      break;
+
+    case resample_quality_high:
+      resample->taps = 64;
+      beta = 10;
+      rolloff = 0.95;
+      break;
+
+    case resample_quality_medium:
+    default:
+      resample->taps = 32;
+      beta = 8.5;
+      rolloff = 0.91;
+      break;
+  }
+
+  resample->coefficients = malloc(resample->up * resample->taps * sizeof(int32_t));
+  resample->history[0] = calloc(resample->taps + RESAMPLE_CHUNK_SIZE, sizeof(int32_t));
+  resample->history[1] = calloc(resample->taps + RESAMPLE_CHUNK_SIZE, sizeof(int32_t));
+  if (resample->coefficients == NULL || resample->history[0] == NULL || resample->history[1] == NULL)
+  {
+    LOGE(TAG, "Failed to allocate resampler.");
+    resample_release(resample);
+    return false;
+  }
+
+  resample_design(resample, beta, rolloff);
+
+  // Start with a window of silence
+  resample->fill = resample->taps - 1;
+
+  resample->max = (1 << (bits - 1)) - 1;
+  resample->min = -(1 << (bits - 1));
+
+  LOGI(TAG, "Resampling %u Hz to %u Hz with %u phases of %u taps.", input_rate, output_rate, resample->up, resample->taps);
+
+  return true;
+}
+
+/**
+  @brief  Free memory held by a resampler
+
+  @param  resample Resampler to release
+  @retval none
+*/
+void resample_release(resample_t* resample)
+{
+  assert(resample != NULL);
+
+  free(resample->coefficients);
+  free(resample->history[0]);
+  free(resample->history[1]);
+
+  memset(resample, 0, sizeof(resample_t));
+}
+
+/**
+  @brief  Resample a batch of interleaved stereo frames. All input is consumed
+
+  @param  resample Resampler
+  @param  input Interleaved input samples
+  @param  count Number of input frames. At most RESAMPLE_CHUNK_SIZE
+  @param  output Interleaved output samples. Room for count * RESAMPLE_MAX_RATIO + 1 frames
+  @retval size_t - Number of output frames
+*/
+size_t resample_process(resample_t* resample, const int32_t* input, size_t count, int32_t* output)
+{
+  assert(resample != NULL);
+  assert(count <= RESAMPLE_CHUNK_SIZE);
+
+  // Deinterleave into each channel's history
+  for (size_t i = 0; i < count; i++)
+  {
+    resample->history[0][resample->fill + i] = input[2 * i];
+    resample->history[1][resample->fill + i] = input[2 * i + 1];
+  }
+  resample->fill += count;
+
+  size_t produced = 0;
+  while (resample->position + resample->taps <= resample->fill)
+  {
+    int64_t accumulators[2];
+    resample_filter(&resample->coefficients[resample->phase * resample->taps], &resample->history[0][resample->position], &resample->history[1][resample->position], resample->taps, accumulators);
+
+    for (uint8_t c = 0; c < 2; c++)
+    {
+      int32_t sample = (accumulators[c] + (1LL << (RESAMPLE_COEFF_BITS - 1))) >> RESAMPLE_COEFF_BITS;
+      output[2 * produced + c] = MAX(resample->min, MIN(sample, resample->max));
+    }
+    produced++;
+
+    // Step the phase and move the window past consumed input
+    resample->phase += resample->down;
+    resample->position += resample->phase / resample->up;
+    resample->phase %= resample->up;
+  }
+
+  // Discard history before the next window
+  size_t discard = MIN(resample->position, resample->fill);
+  for (uint8_t c = 0; c < 2; c++)
+    memmove(resample->history[c], &resample->history[c][discard], (resample->fill - discard) * sizeof(int32_t));
+
+  resample->fill -= discard;
+  resample->position -= discard;
+
+  return produced;
+}
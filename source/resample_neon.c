@@ -0,0 +1,42 @@
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+
+#include "resample.h"
+
+/**
+  @brief  Filter a stereo output frame with NEON, 4 taps at a time. Both
+          channels share each load of coefficients
+
+  @param  coefficients Time reversed coefficients of the phase
+  @param  left History of the left channel at the window start
+  @param  right History of the right channel at the window start
+  @param  taps Number of coefficients. Multiple of 4
+  @param  output Left and right accumulators scaled by the coefficient format
+  @retval none
+*/
+void resample_filter_neon(const int32_t* coefficients, const int32_t* left, const int32_t* right, size_t taps, int64_t* output)
+{
+  int64x2_t l_lo = vdupq_n_s64(0);
+  int64x2_t l_hi = vdupq_n_s64(0);
+  int64x2_t r_lo = vdupq_n_s64(0);
+  int64x2_t r_hi = vdupq_n_s64(0);
+
+  for (size_t i = 0; i < taps; i += 4)
+  {
+    int32x4_t c = vld1q_s32(&coefficients[i]);
+    int32x4_t l = vld1q_s32(&left[i]);
+    int32x4_t r = vld1q_s32(&right[i]);
+
+    l_lo = vmlal_s32(l_lo, vget_low_s32(c), vget_low_s32(l));
+    l_hi = vmlal_s32(l_hi, vget_high_s32(c), vget_high_s32(l));
+    r_lo = vmlal_s32(r_lo, vget_low_s32(c), vget_low_s32(r));
+    r_hi = vmlal_s32(r_hi, vget_high_s32(c), vget_high_s32(r));
+  }
+
+  int64x2_t l_sum = vaddq_s64(l_lo, l_hi);
+  int64x2_t r_sum = vaddq_s64(r_lo, r_hi);
+
+  output[0] = vgetq_lane_s64(l_sum, 0) + vgetq_lane_s64(l_sum, 1);
+  output[1] = vgetq_lane_s64(r_sum, 0) + vgetq_lane_s64(r_sum, 1);
+}
+#endif
@@ -0,0 +1,90 @@
+#include "sample.h"
+#include "log.h"
+#include "utils.h"
+
+#define TAG "Sample"
+
+// Unpackers selected at init
+static sample_unpacker_t sample_unpack_s16le_impl = sample_unpack_s16le_scalar;
+static sample_unpacker_t sample_unpack_s24le_impl = sample_unpack_s24le_scalar;
+
+/**
+  @brief  Unpack signed 16 bit little endian samples
+
+  @param  data Packed sample bytes
+  @param  samples Destination for sign extended samples
+  @param  count Number of samples to unpack
+  @retval none
+*/
+void sample_unpack_s16le_scalar(const uint8_t* data, int32_t* samples, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+    samples[i] = (int16_t)(data[2 * i + 1] << 8 | data[2 * i]);
+}
+
+/**
+  @brief  Unpack signed 24 bit little endian samples packed in 3 bytes
+
+  @param  data Packed sample bytes
+  @param  samples Destination for sign extended samples
+  @param  count Number of samples to unpack
+  @retval none
+*/
+void sample_unpack_s24le_scalar(const uint8_t* data, int32_t* samples, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    const uint8_t* sample = &data[3 * i];
+
+    // Place in the top of the word and shift down to sign extend
+    samples[i] = (int32_t)((uint32_t)sample[2] << 24 | sample[1] << 16 | sample[0] << 8) >> 8;
+  }
+}
+
+/**
+  @brief  Select the fastest unpackers supported by this CPU
+
+  @param  none
+  @retval none
+*/
+void sample_init()
+{
+#if defined(RASPDIF_NEON)
+  if (neon_supported())
+  {
+    sample_unpack_s16le_impl = sample_unpack_s16le_neon;
+    sample_unpack_s24le_impl = sample_unpack_s24le_neon;
+
+    LOGD(TAG, "Using NEON sample unpackers.");
+    return;
+  }
+#endif
+
+  LOGD(TAG, "Using scalar sample unpackers.");
+}
+
+/**
+  @brief  Unpack a batch of signed 16 bit little endian samples into aligned words
+
+  @param  data Packed sample bytes
+  @param  samples Destination for sign extended samples
+  @param  count Number of samples to unpack
+  @retval none
+*/
+void sample_unpack_s16le(const uint8_t* data, int32_t* samples, size_t count)
+{
+  sample_unpack_s16le_impl(data, samples, count);
+}
+
+/**
+  @brief  Unpack a batch of signed 24 bit little endian samples into aligned words
+
+  @param  data Packed sample bytes
+  @param  samples Destination for sign extended samples
+  @param  count Number of samples to unpack
+  @retval none
+*/
+void sample_unpack_s24le(const uint8_t* data, int32_t* samples, size_t count)
+{
+  sample_unpack_s24le_impl(data, samples, count);
+}
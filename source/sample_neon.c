@@ -0,0 +1,64 @@
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+
+#include "sample.h"
+
+/**
+  @brief  Unpack signed 16 bit little endian samples 16 at a time with NEON
+
+  @param  data Packed sample bytes
+  @param  samples Destination for sign extended samples
+  @param  count Number of samples to unpack
+  @retval none
+*/
+void sample_unpack_s16le_neon(const uint8_t* data, int32_t* samples, size_t count)
+{
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16)
+  {
+    int16x8_t lo = vreinterpretq_s16_u8(vld1q_u8(&data[2 * i]));
+    int16x8_t hi = vreinterpretq_s16_u8(vld1q_u8(&data[2 * i + 16]));
+
+    vst1q_s32(&samples[i], vmovl_s16(vget_low_s16(lo)));
+    vst1q_s32(&samples[i + 4], vmovl_s16(vget_high_s16(lo)));
+    vst1q_s32(&samples[i + 8], vmovl_s16(vget_low_s16(hi)));
+    vst1q_s32(&samples[i + 12], vmovl_s16(vget_high_s16(hi)));
+  }
+
+  // Unpack remainder
+  sample_unpack_s16le_scalar(&data[2 * i], &samples[i], count - i);
+}
+
+/**
+  @brief  Unpack signed 24 bit little endian samples 16 at a time with NEON
+
+  @param  data Packed sample bytes
+  @param  samples Destination for sign extended samples
+  @param  count Number of samples to unpack
+  @retval none
+*/
+void sample_unpack_s24le_neon(const uint8_t* data, int32_t* samples, size_t count)
+{
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16)
+  {
+    // De-interleave the low, middle and high bytes of each sample
+    uint8x16x3_t bytes = vld3q_u8(&data[3 * i]);
+
+    // Low 16 bits, and the sign extended high byte
+    uint16x8_t lo_0 = vorrq_u16(vmovl_u8(vget_low_u8(bytes.val[0])), vshll_n_u8(vget_low_u8(bytes.val[1]), 8));
+    uint16x8_t lo_1 = vorrq_u16(vmovl_u8(vget_high_u8(bytes.val[0])), vshll_n_u8(vget_high_u8(bytes.val[1]), 8));
+    int16x8_t hi_0 = vmovl_s8(vreinterpret_s8_u8(vget_low_u8(bytes.val[2])));
+    int16x8_t hi_1 = vmovl_s8(vreinterpret_s8_u8(vget_high_u8(bytes.val[2])));
+
+    // Combine into sign extended words
+    vst1q_s32(&samples[i], vorrq_s32(vshll_n_s16(vget_low_s16(hi_0), 16), vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(lo_0)))));
+    vst1q_s32(&samples[i + 4], vorrq_s32(vshll_n_s16(vget_high_s16(hi_0), 16), vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(lo_0)))));
+    vst1q_s32(&samples[i + 8], vorrq_s32(vshll_n_s16(vget_low_s16(hi_1), 16), vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(lo_1)))));
+    vst1q_s32(&samples[i + 12], vorrq_s32(vshll_n_s16(vget_high_s16(hi_1), 16), vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(lo_1)))));
+  }
+
+  // Unpack remainder
+  sample_unpack_s24le_scalar(&data[3 * i], &samples[i], count - i);
+}
+#endif
@@ -1,148 +1,223 @@
 #include <arm_acle.h>
+#include <assert.h>
 #include <string.h>
+#include <sys/param.h>
 
+#include "log.h"
 #include "spdif.h"
+#include "spdif_bmc.h"
 
 #define TAG "SPDIF"
 
-// Inverted if preceding bit state was 1
-// Which shouldn't happen due to even parity
-#define SPDIF_PREAMBLE_M 0xE2 // Sub-frame 1
-#define SPDIF_PREAMBLE_W 0xE4 // Sub-frame 2
-#define SPDIF_PREAMBLE_B 0xE8 // Sub-frame 1, start of block
+#define SPDIF_BATCH_SIZE 64 // Number of frames packed per call to the BMC encoder
+
+// BMC encoder selected at init
+static spdif_bmc_encoder_t spdif_bmc_encode = spdif_bmc_encode_nibble;
 
 /**
-  @brief  Encode the provided 32 bit data into BMC with the provided preamble
+  @brief  Select the BMC encoder. Benchmarks all supported encoders
+          and selects the fastest if no encoder is requested
 
-  @param  preamble Preamble type for this subframe
-  @param  data 32 bit sub-frame data to encode
-  @retval uint64_t - BMC encoded subframe
+  @param  encoder Name of encoder to use. NULL to autotune
+  @retval none
 */
-static uint64_t spdif_encode_biphase_mark(spdif_preamble_t preamble, uint32_t data)
+void spdif_init(const char* encoder)
 {
-  // Biphase Mark
-  // Each bit to be transmitted is 2 binary states
-  // 1st is always different from previous, 2nd is identical if 0, different if 1
-  // Assuming previous was 0
-  // 0000 -> 1100 1100
-  // 0001 -> 1100 1101
-  // 0010 -> 1100 1011
-  // 0011 -> 1100 1010
-
-  // 0100 -> 1101 0011
-  // 0101 -> 1101 0010
-  // 0110 -> 1101 0100
-  // 0111 -> 1101 0101
-
-  // 1000 -> 1011 0011
-  // 1001 -> 1011 0010
-  // 1010 -> 1011 0100
-  // 1011 -> 1011 0101
-
-  // 1100 -> 1010 1100
-  // 1101 -> 1010 1101
-  // 1110 -> 1010 1011
-  // 1111 -> 1010 1010
-
-  // Example of first subframe
-  // Ignored    | Aux       | Sample                              | Valid | User | Status | Parity
-  // 0000       | 0000      | 0000 0000 0000 0000 0000            | 1     | 0    | 0      | 1
-  // 11101000   | 1100 1100 | 11001100 11001100 11001100 11001100 | 10    | 11   | 00     | 10
-
-  // LUT to BMC encode nibbles
-  // Invert if last state was 1
-  // clang-format off
-  static uint8_t bmc_lut_0[16] = 
-  {
-    0xCC, 0xCD, 0xCB, 0xCA,
-    0xD3, 0xD2, 0xD4, 0xD5,
-    0xB3, 0xB2, 0xB4, 0xB5,
-    0xAC, 0xAD, 0xAB, 0xAA,
-  };
-  // clang-format on
+  const spdif_bmc_backend_t* backend = NULL;
+  if (encoder != NULL)
+    backend = spdif_bmc_find(encoder);
+  else
+    backend = spdif_bmc_autotune();
 
-  union
+  if (backend == NULL)
   {
-    uint8_t byte[8];
-    uint64_t raw;
-  } bmc;
+    LOGF(TAG, "Failed to select BMC encoder.");
+    return;
+  }
 
-  // Set preamble bits
-  switch (preamble)
+  spdif_bmc_encode = backend->encode;
+  LOGI(TAG, "Using %s BMC encoder.", backend->name);
+}
+
+/**
+  @brief  Get the position of the sample LSB within a subframe for the bit depth
+
+  @param  depth Bit depth of sample
+  @retval uint8_t - Shift of sample within raw subframe
+*/
+static inline __attribute__((always_inline)) uint8_t spdif_sample_shift(spdif_sample_depth_t depth)
+{
+  switch (depth)
   {
-    case spdif_preamble_b:
-      bmc.byte[7] = SPDIF_PREAMBLE_B;
-      break;
+    case spdif_sample_depth_16:
+      return 12; // Scale to 20 bits, no aux
 
-    case spdif_preamble_m:
-      bmc.byte[7] = SPDIF_PREAMBLE_M;
-      break;
+    case spdif_sample_depth_20:
+      return 8; // No aux
 
-    case spdif_preamble_w:
-      bmc.byte[7] = SPDIF_PREAMBLE_W;
-      break;
-  }
+    case spdif_sample_depth_24:
+      return 4; // LSB is aux data
 
-  // Encode data a nibble at a time
-  // Code is inversted if previous state was 1
-  // Aux Data
-  bmc.byte[6] = bmc_lut_0[(data >> 24) & 0xF]; // No need to check last state, preamble guarantees 0
-  // Sample
-  bmc.byte[5] = bmc_lut_0[(data >> 20) & 0xF] ^ -(int)(bmc.byte[6] & 1); // Branchless inversion yo!
-  bmc.byte[4] = bmc_lut_0[(data >> 16) & 0xF] ^ -(int)(bmc.byte[5] & 1);
-  bmc.byte[3] = bmc_lut_0[(data >> 12) & 0xF] ^ -(int)(bmc.byte[4] & 1);
-  bmc.byte[2] = bmc_lut_0[(data >> 8) & 0xF] ^ -(int)(bmc.byte[3] & 1);
-  bmc.byte[1] = bmc_lut_0[(data >> 4) & 0xF] ^ -(int)(bmc.byte[2] & 1);
-  // Valid, User, Status, Parity
-  bmc.byte[0] = bmc_lut_0[(data >> 0) & 0xF] ^ -(int)(bmc.byte[1] & 1);
-
-  return bmc.raw;
+    default:
+      return 0;
+  }
 }
 
 /**
-  @brief  Update and encode a SPDIF subframe with the provided sample and preamble
+  @brief  Combine a sample with the subframe template to form a data word for the BMC encoder
 
-  @param  subframe SPDIF subframe buffer with channel status data
-  @param  preamble Preamble type for this subframe
+  @param  template Data word of subframe with only fixed bits set
   @param  depth Bit depth of sample
   @param  sample PCM audio sample
-  @retval uint64_t - BMC encoded subframe
+  @retval uint32_t - Data word for BMC encoder
+*/
+static inline __attribute__((always_inline)) uint32_t spdif_pack_word(uint32_t template, spdif_sample_depth_t depth, int32_t sample)
+{
+  // Position sample over the aux and sample fields
+  uint32_t audio = ((uint32_t)sample << spdif_sample_shift(depth)) & 0x0FFFFFF0;
+
+  // PCM peripheral transmits MSBit first so bitflip data
+  // Parity is in the LSB after the flip and the template holds the parity of the fixed bits
+  return template ^ __rbit(audio) ^ __builtin_parity(audio);
+}
+
+/**
+  @brief  Encode frames for a fixed bit depth. Inlined per depth so the
+          depth switch is resolved outside of the loop
+
+  @param  block SPDIF block with subframe templates
+  @param  frame_index Position within SPDIF block of first frame
+  @param  depth Bit depth of samples
+  @param  samples Interleaved audio samples. 2 per frame
+  @param  count Number of frames to encode
+  @param  codes Destination for encoded frames
+  @retval uint8_t - Position within SPDIF block of next frame
 */
-uint64_t spdif_build_subframe(spdif_subframe_t* subframe, spdif_preamble_t preamble, spdif_sample_depth_t depth, int32_t sample)
+static inline __attribute__((always_inline)) uint8_t spdif_encode_frames_depth(const spdif_block_t* block, uint8_t frame_index, spdif_sample_depth_t depth, const int32_t* samples, size_t count, spdif_frame_code_t* codes)
 {
+  uint32_t data[2 * SPDIF_BATCH_SIZE];
+
+  while (count > 0)
+  {
+    size_t batch = MIN(count, SPDIF_BATCH_SIZE);
+
+    // Pack a batch of subframes
+    for (size_t i = 0; i < batch; i++)
+    {
+      const uint32_t* template = block->templates[frame_index];
+
+      data[2 * i] = spdif_pack_word(template[0], depth, samples[2 * i]);
+      data[2 * i + 1] = spdif_pack_word(template[1], depth, samples[2 * i + 1]);
+
+      if (++frame_index == SPDIF_FRAME_COUNT)
+        frame_index = 0;
+    }
+
+    // Encode batch directly to destination
+    spdif_bmc_encode(data, &codes->a, 2 * batch);
+
+    samples += 2 * batch;
+    codes += batch;
+    count -= batch;
+  }
+
+  return frame_index;
+}
+
+/**
+  @brief  Encode a batch of stereo samples into consecutive SPDIF frames
+
+  @param  block SPDIF block with subframe templates
+  @param  frame_index Position within SPDIF block of first frame
+  @param  depth Bit depth of samples
+  @param  samples Interleaved audio samples. 2 per frame
+  @param  count Number of frames to encode
+  @param  codes Destination for encoded frames
+  @retval uint8_t - Position within SPDIF block of next frame
+*/
+uint8_t spdif_encode_frames(const spdif_block_t* block, uint8_t frame_index, spdif_sample_depth_t depth, const int32_t* samples, size_t count, spdif_frame_code_t* codes)
+{
+  assert(frame_index < SPDIF_FRAME_COUNT);
+
   switch (depth)
   {
     case spdif_sample_depth_16:
-      subframe->sample = sample << 4; // Scale to 20 bits
-      subframe->aux = 0;
-      break;
+      return spdif_encode_frames_depth(block, frame_index, spdif_sample_depth_16, samples, count, codes);
 
     case spdif_sample_depth_20:
-      subframe->sample = sample;
-      subframe->aux = 0;
-      break;
+      return spdif_encode_frames_depth(block, frame_index, spdif_sample_depth_20, samples, count, codes);
 
     case spdif_sample_depth_24:
-      subframe->sample = sample >> 4; // MSB store in sample
-      subframe->aux = sample & 0xF;   // LSB is aux data
-      break;
+      return spdif_encode_frames_depth(block, frame_index, spdif_sample_depth_24, samples, count, codes);
   }
 
-  subframe->validity = 0; // 0 Indicates OK. Dumb
-  subframe->parity = 0;   // Reset parity before calculating
-  subframe->parity = __builtin_popcount(subframe->raw) % 2;
+  return frame_index;
+}
+
+/**
+  @brief  Build the template data word of a subframe. Contains the bits which
+          are fixed for the frame; preamble, validity, user and channel status
+
+  @param  subframe SPDIF subframe with channel status data
+  @param  preamble Preamble type for this subframe
+  @retval uint32_t - Bit reversed subframe with preamble type in top nibble
+*/
+static uint32_t spdif_build_template(spdif_subframe_t subframe, spdif_preamble_t preamble)
+{
+  subframe.preamble = 0;
+  subframe.aux = 0;
+  subframe.sample = 0;
+  subframe.validity = 0; // 0 Indicates OK. Dumb
+  subframe.parity = 0;   // Reset parity before calculating
+  subframe.parity = __builtin_parity(subframe.raw);
+
+  // PCM peripheral transmits MSBit first so bitflip data
+  return __rbit(subframe.raw) | (uint32_t)preamble << SPDIF_BMC_PREAMBLE_SHIFT;
+}
+
+/**
+  @brief  Get the channel status code of a sample rate
+
+  @param  sample_rate Sample rate in Hertz
+  @retval uint8_t - Sampling frequency code. Not indicated if unrecognized
+*/
+static uint8_t spdif_sample_frequency_code(double sample_rate)
+{
+  static const struct
+  {
+    double rate;
+    uint8_t code;
+  } codes[] = {
+    {22.05e3, 4},
+    {24e3, 6},
+    {32e3, 3},
+    {44.1e3, 0},
+    {48e3, 2},
+    {88.2e3, 8},
+    {96e3, 10},
+    {176.4e3, 12},
+    {192e3, 14},
+  };
+
+  for (size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); i++)
+  {
+    if (codes[i].rate == sample_rate)
+      return codes[i].code;
+  }
 
-  // Encode to biphase mark. PCM peripheral transmits MSBit first so bitflip data
-  return spdif_encode_biphase_mark(preamble, __rbit(subframe->raw));
+  return 1; // Not indicated
 }
 
 /**
   @brief  Populate the SPDIF block with channel status data
+          and build the subframe templates for each frame
 
   @param  block SPDIF block to populate
+  @param  sample_rate Sample rate to indicate
+  @param  depth Sample depth to indicate
   @retval none
 */
-void spdif_populate_channel_status(spdif_block_t* block)
+void spdif_populate_channel_status(spdif_block_t* block, double sample_rate, spdif_sample_depth_t depth)
 {
   // Define the SPDIF channel status data
   spdif_pcm_channel_status_t channel_status_a;
@@ -159,11 +234,27 @@ void spdif_populate_channel_status(spdif_block_t* block)
   channel_status_a.source_number = 0;  // Not indicated
   channel_status_a.channel_number = 1; // Left channel
 
-  channel_status_a.sample_frequency = 1; // Not indicated
-  channel_status_a.clock_accuracy = 0;   // Level 2 TODO What is L2?
+  channel_status_a.sample_frequency = spdif_sample_frequency_code(sample_rate);
+  channel_status_a.clock_accuracy = 0; // Level 2 TODO What is L2?
+
+  switch (depth)
+  {
+    case spdif_sample_depth_16:
+      channel_status_a.word_length = 0;        // Max sample length is 20 bits
+      channel_status_a.sample_word_length = 1; // 16 bits
+      break;
+
+    case spdif_sample_depth_20:
+      channel_status_a.word_length = 0;        // Max sample length is 20 bits
+      channel_status_a.sample_word_length = 5; // 20 bits
+      break;
+
+    case spdif_sample_depth_24:
+      channel_status_a.word_length = 1;        // Max sample length is 24 bits
+      channel_status_a.sample_word_length = 5; // 24 bits
+      break;
+  }
 
-  channel_status_a.word_length = 0;                 // Max sample length is 20 bits. TODO If we do S24LE this should probably change?
-  channel_status_a.sample_word_length = 0;          // Not indicated
   channel_status_a.original_sampling_frequency = 0; // Not indicated
 
   // Duplicate channel status for B and update channel number
@@ -176,5 +267,8 @@ void spdif_populate_channel_status(spdif_block_t* block)
     spdif_frame_t* frame = &block->frames[i];
     frame->a.channel_status = channel_status_a.raw[i / 8] >> (i % 8);
     frame->b.channel_status = channel_status_b.raw[i / 8] >> (i % 8);
+
+    block->templates[i][0] = spdif_build_template(frame->a, i == 0 ? spdif_preamble_b : spdif_preamble_m);
+    block->templates[i][1] = spdif_build_template(frame->b, spdif_preamble_w);
   }
 }
\ No newline at end of file
@@ -0,0 +1,338 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+
+#include "log.h"
+#include "spdif_bmc.h"
+#include "utils.h"
+
+#define TAG "BMC"
+
+#define SPDIF_BMC_BENCHMARK_SIZE   1024 // Number of subframes encoded per benchmark pass
+#define SPDIF_BMC_BENCHMARK_PASSES 32   // Number of passes timed per encoder
+
+// Inverted if preceding bit state was 1
+// Which shouldn't happen due to even parity
+#define SPDIF_PREAMBLE_M 0xE2 // Sub-frame 1
+#define SPDIF_PREAMBLE_W 0xE4 // Sub-frame 2
+#define SPDIF_PREAMBLE_B 0xE8 // Sub-frame 1, start of block
+
+// Biphase Mark
+// Each bit to be transmitted is 2 binary states
+// 1st is always different from previous, 2nd is identical if 0, different if 1
+// Assuming previous was 0
+// 0000 -> 1100 1100
+// 0001 -> 1100 1101
+// 0010 -> 1100 1011
+// 0011 -> 1100 1010
+
+// 0100 -> 1101 0011
+// 0101 -> 1101 0010
+// 0110 -> 1101 0100
+// 0111 -> 1101 0101
+
+// 1000 -> 1011 0011
+// 1001 -> 1011 0010
+// 1010 -> 1011 0100
+// 1011 -> 1011 0101
+
+// 1100 -> 1010 1100
+// 1101 -> 1010 1101
+// 1110 -> 1010 1011
+// 1111 -> 1010 1010
+
+// Example of first subframe
+// Ignored    | Aux       | Sample                              | Valid | User | Status | Parity
+// 0000       | 0000      | 0000 0000 0000 0000 0000            | 1     | 0    | 0      | 1
+// 11101000   | 1100 1100 | 11001100 11001100 11001100 11001100 | 10    | 11   | 00     | 10
+
+// LUT to BMC encode nibbles
+// Invert if last state was 1
+// clang-format off
+const uint8_t spdif_bmc_lut_nibble[16] =
+{
+  0xCC, 0xCD, 0xCB, 0xCA,
+  0xD3, 0xD2, 0xD4, 0xD5,
+  0xB3, 0xB2, 0xB4, 0xB5,
+  0xAC, 0xAD, 0xAB, 0xAA,
+};
+// clang-format on
+
+// LUT of preamble codes indexed by preamble type
+const uint8_t spdif_bmc_lut_preamble[16] = {
+  [spdif_preamble_m] = SPDIF_PREAMBLE_M,
+  [spdif_preamble_w] = SPDIF_PREAMBLE_W,
+  [spdif_preamble_b] = SPDIF_PREAMBLE_B,
+};
+
+// LUTs to BMC encode bytes and 16 bit words. Generated at init
+static uint16_t spdif_bmc_lut_byte[256];
+static uint32_t spdif_bmc_lut_halfword[65536];
+
+/**
+  @brief  Encode the provided data words into BMC a nibble at a time
+
+  @param  data Bit reversed sub-frame data with preamble type in the top nibble
+  @param  codes Destination for BMC encoded subframes
+  @param  count Number of subframes to encode
+  @retval none
+*/
+void spdif_bmc_encode_nibble(const uint32_t* data, spdif_subframe_code_t* codes, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    uint32_t word = data[i];
+
+    union
+    {
+      uint8_t byte[8];
+      uint64_t raw;
+    } bmc;
+
+    // Set preamble bits
+    bmc.byte[7] = spdif_bmc_lut_preamble[word >> SPDIF_BMC_PREAMBLE_SHIFT];
+
+    // Encode data a nibble at a time
+    // Code is inversted if previous state was 1
+    // Aux Data
+    bmc.byte[6] = spdif_bmc_lut_nibble[(word >> 24) & 0xF]; // No need to check last state, preamble guarantees 0
+    // Sample
+    bmc.byte[5] = spdif_bmc_lut_nibble[(word >> 20) & 0xF] ^ -(int)(bmc.byte[6] & 1); // Branchless inversion yo!
+    bmc.byte[4] = spdif_bmc_lut_nibble[(word >> 16) & 0xF] ^ -(int)(bmc.byte[5] & 1);
+    bmc.byte[3] = spdif_bmc_lut_nibble[(word >> 12) & 0xF] ^ -(int)(bmc.byte[4] & 1);
+    bmc.byte[2] = spdif_bmc_lut_nibble[(word >> 8) & 0xF] ^ -(int)(bmc.byte[3] & 1);
+    bmc.byte[1] = spdif_bmc_lut_nibble[(word >> 4) & 0xF] ^ -(int)(bmc.byte[2] & 1);
+    // Valid, User, Status, Parity
+    bmc.byte[0] = spdif_bmc_lut_nibble[(word >> 0) & 0xF] ^ -(int)(bmc.byte[1] & 1);
+
+    codes[i].msb = bmc.raw >> 32;
+    codes[i].lsb = bmc.raw;
+  }
+}
+
+/**
+  @brief  Encode the provided data words into BMC a byte at a time.
+          Polarity of the previous byte is carried into the next
+
+  @param  data Bit reversed sub-frame data with preamble type in the top nibble
+  @param  codes Destination for BMC encoded subframes
+  @param  count Number of subframes to encode
+  @retval none
+*/
+void spdif_bmc_encode_byte(const uint32_t* data, spdif_subframe_code_t* codes, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    uint32_t word = data[i];
+
+    // Aux data. No need to check last state, preamble guarantees 0
+    uint32_t aux = spdif_bmc_lut_nibble[(word >> 24) & 0xF];
+
+    // Sample, then Valid, User, Status, Parity
+    uint32_t code_54 = (uint16_t)(spdif_bmc_lut_byte[(word >> 16) & 0xFF] ^ -(aux & 1));
+    uint32_t code_32 = (uint16_t)(spdif_bmc_lut_byte[(word >> 8) & 0xFF] ^ -(code_54 & 1));
+    uint32_t code_10 = (uint16_t)(spdif_bmc_lut_byte[(word >> 0) & 0xFF] ^ -(code_32 & 1));
+
+    codes[i].msb = spdif_bmc_lut_preamble[word >> SPDIF_BMC_PREAMBLE_SHIFT] << 24 | aux << 16 | code_54;
+    codes[i].lsb = code_32 << 16 | code_10;
+  }
+}
+
+/**
+  @brief  Encode the provided data words into BMC 16 bits at a time
+
+  @param  data Bit reversed sub-frame data with preamble type in the top nibble
+  @param  codes Destination for BMC encoded subframes
+  @param  count Number of subframes to encode
+  @retval none
+*/
+void spdif_bmc_encode_halfword(const uint32_t* data, spdif_subframe_code_t* codes, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    uint32_t word = data[i];
+
+    // Aux and upper sample. Preamble nibble is masked, so the table encodes it
+    // as 0000 which leaves the state unchanged for the aux nibble
+    uint32_t code_hi = spdif_bmc_lut_halfword[(word >> 16) & 0x0FFF];
+
+    // Lower sample, Valid, User, Status, Parity
+    uint32_t code_lo = spdif_bmc_lut_halfword[word & 0xFFFF] ^ -(code_hi & 1);
+
+    codes[i].msb = spdif_bmc_lut_preamble[word >> SPDIF_BMC_PREAMBLE_SHIFT] << 24 | (code_hi & 0x00FFFFFF);
+    codes[i].lsb = code_lo;
+  }
+}
+
+/**
+  @brief  Prepare the nibble encoder. Tables are static
+
+  @param  none
+  @retval bool - Encoder is supported
+*/
+static bool spdif_bmc_init_nibble()
+{
+  return true;
+}
+
+/**
+  @brief  Generate the byte lookup table from the nibble encoder
+
+  @param  none
+  @retval bool - Encoder is supported
+*/
+static bool spdif_bmc_init_byte()
+{
+  // Leading nibbles of zero leave the state at 0, so the low bits of a
+  // nibble encoded word are the code of that value from a 0 state
+  for (uint32_t i = 0; i < 256; i++)
+  {
+    spdif_subframe_code_t code;
+    spdif_bmc_encode_nibble(&i, &code, 1);
+    spdif_bmc_lut_byte[i] = code.lsb;
+  }
+
+  return true;
+}
+
+/**
+  @brief  Generate the 16 bit lookup table from the nibble encoder
+
+  @param  none
+  @retval bool - Encoder is supported
+*/
+static bool spdif_bmc_init_halfword()
+{
+  for (uint32_t i = 0; i < 65536; i++)
+  {
+    spdif_subframe_code_t code;
+    spdif_bmc_encode_nibble(&i, &code, 1);
+    spdif_bmc_lut_halfword[i] = code.lsb;
+  }
+
+  return true;
+}
+
+// Registry of available encoders. Reference encoder first
+static const spdif_bmc_backend_t spdif_bmc_backends[] = {
+  {"nibble", spdif_bmc_encode_nibble, spdif_bmc_init_nibble},
+  {"byte", spdif_bmc_encode_byte, spdif_bmc_init_byte},
+  {"halfword", spdif_bmc_encode_halfword, spdif_bmc_init_halfword},
+#if defined(RASPDIF_NEON)
+  {"neon", spdif_bmc_encode_neon, neon_supported},
+#endif
+};
+
+#define SPDIF_BMC_BACKEND_COUNT (sizeof(spdif_bmc_backends) / sizeof(spdif_bmc_backend_t))
+
+/**
+  @brief  Find and prepare the encoder with the given name
+
+  @param  name Name of encoder
+  @retval const spdif_bmc_backend_t* - NULL if unknown or unsupported
+*/
+const spdif_bmc_backend_t* spdif_bmc_find(const char* name)
+{
+  for (size_t i = 0; i < SPDIF_BMC_BACKEND_COUNT; i++)
+  {
+    const spdif_bmc_backend_t* backend = &spdif_bmc_backends[i];
+    if (strcmp(backend->name, name) != 0)
+      continue;
+
+    if (!backend->init())
+    {
+      LOGW(TAG, "Encoder '%s' is not supported on this CPU.", name);
+      return NULL;
+    }
+
+    return backend;
+  }
+
+  LOGW(TAG, "Unknown encoder '%s'.", name);
+  return NULL;
+}
+
+/**
+  @brief  Measure the fastest time to encode the benchmark data
+
+  @param  backend Encoder to measure
+  @param  data Benchmark data words
+  @param  codes Destination for encoded subframes
+  @retval uint64_t - Best pass time in nanoseconds
+*/
+static uint64_t spdif_bmc_benchmark(const spdif_bmc_backend_t* backend, const uint32_t* data, spdif_subframe_code_t* codes)
+{
+  // Warm up caches and tables
+  backend->encode(data, codes, SPDIF_BMC_BENCHMARK_SIZE);
+
+  uint64_t best = UINT64_MAX;
+  for (uint32_t i = 0; i < SPDIF_BMC_BENCHMARK_PASSES; i++)
+  {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    backend->encode(data, codes, SPDIF_BMC_BENCHMARK_SIZE);
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint64_t elapsed = (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+    best = MIN(best, elapsed);
+  }
+
+  return best;
+}
+
+/**
+  @brief  Benchmark all supported encoders on this CPU and select the fastest.
+          Encoders are verified against the nibble encoder before use
+
+  @param  none
+  @retval const spdif_bmc_backend_t* - Fastest encoder
+*/
+const spdif_bmc_backend_t* spdif_bmc_autotune()
+{
+  static uint32_t data[SPDIF_BMC_BENCHMARK_SIZE];
+  static spdif_subframe_code_t reference[SPDIF_BMC_BENCHMARK_SIZE];
+  static spdif_subframe_code_t codes[SPDIF_BMC_BENCHMARK_SIZE];
+
+  // Generate random subframes with valid preamble types
+  for (size_t i = 0; i < SPDIF_BMC_BENCHMARK_SIZE; i++)
+  {
+    uint32_t word = (uint32_t)rand() ^ (uint32_t)rand() << 16;
+    data[i] = (word & ~(0xFU << SPDIF_BMC_PREAMBLE_SHIFT)) | (i % 3) << SPDIF_BMC_PREAMBLE_SHIFT;
+  }
+
+  spdif_bmc_encode_nibble(data, reference, SPDIF_BMC_BENCHMARK_SIZE);
+
+  const spdif_bmc_backend_t* fastest = &spdif_bmc_backends[0];
+  uint64_t fastest_time = UINT64_MAX;
+  for (size_t i = 0; i < SPDIF_BMC_BACKEND_COUNT; i++)
+  {
+    const spdif_bmc_backend_t* backend = &spdif_bmc_backends[i];
+    if (!backend->init())
+    {
+      LOGD(TAG, "Encoder '%s' is not supported on this CPU.", backend->name);
+      continue;
+    }
+
+    uint64_t time = spdif_bmc_benchmark(backend, data, codes);
+
+    if (memcmp(codes, reference, sizeof(reference)) != 0)
+    {
+      LOGE(TAG, "Encoder '%s' failed verification.", backend->name);
+      continue;
+    }
+
+    LOGD(TAG, "Encoder '%s' took %llu ns for %d subframes.", backend->name, (unsigned long long)time, SPDIF_BMC_BENCHMARK_SIZE);
+
+    if (time < fastest_time)
+    {
+      fastest = backend;
+      fastest_time = time;
+    }
+  }
+
+  return fastest;
+}
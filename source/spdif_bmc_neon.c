@@ -0,0 +1,77 @@
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+
+#include "spdif_bmc.h"
+
+#define TAG "BMC"
+
+/**
+  @brief  Look up 16 bytes in a 16 entry table. ARMv7 compatible
+
+  @param  table 16 entry table
+  @param  index Table indices
+  @retval uint8x16_t - Table entries
+*/
+static inline uint8x16_t spdif_bmc_neon_lookup(uint8x8x2_t table, uint8x16_t index)
+{
+  return vcombine_u8(vtbl2_u8(table, vget_low_u8(index)), vtbl2_u8(table, vget_high_u8(index)));
+}
+
+/**
+  @brief  Encode the provided data words into BMC 4 subframes at a time with NEON
+
+  @param  data Bit reversed sub-frame data with preamble type in the top nibble
+  @param  codes Destination for BMC encoded subframes
+  @param  count Number of subframes to encode
+  @retval none
+*/
+void spdif_bmc_encode_neon(const uint32_t* data, spdif_subframe_code_t* codes, size_t count)
+{
+  const uint8x8x2_t lut_nibble = {vld1_u8(&spdif_bmc_lut_nibble[0]), vld1_u8(&spdif_bmc_lut_nibble[8])};
+  const uint8x8x2_t lut_preamble = {vld1_u8(&spdif_bmc_lut_preamble[0]), vld1_u8(&spdif_bmc_lut_preamble[8])};
+
+  // Selects the most significant nibble's code of each word, which holds the preamble
+  const uint8x16_t preamble_mask = vreinterpretq_u8_u32(vdupq_n_u32(0xFF000000));
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    uint32x4_t word = vld1q_u32(&data[i]);
+
+    // Line state after each bit, assuming a 0 state before the first data bit.
+    // Every bit toggles the line unless the bit is 1, so the state is a prefix XOR of the inverted data
+    uint32x4_t state = vbicq_u32(vdupq_n_u32(0x0FFFFFFF), word);
+    state = veorq_u32(state, vshrq_n_u32(state, 1));
+    state = veorq_u32(state, vshrq_n_u32(state, 2));
+    state = veorq_u32(state, vshrq_n_u32(state, 4));
+    state = veorq_u32(state, vshrq_n_u32(state, 8));
+    state = veorq_u32(state, vshrq_n_u32(state, 16));
+
+    // A nibble's code is inverted if the state after the preceding nibble was 1.
+    // Shift so that state lands in bit 0 of the nibble it affects
+    uint8x16_t invert = vreinterpretq_u8_u32(vshrq_n_u32(state, 4));
+
+    // Split words into low and high nibbles of each byte
+    uint8x16_t bytes = vreinterpretq_u8_u32(word);
+    uint8x16_t nibble_lo = vandq_u8(bytes, vdupq_n_u8(0x0F));
+    uint8x16_t nibble_hi = vshrq_n_u8(bytes, 4);
+
+    // Encode each nibble, substituting the preamble code in the top nibble
+    uint8x16_t code_lo = spdif_bmc_neon_lookup(lut_nibble, nibble_lo);
+    uint8x16_t code_hi = spdif_bmc_neon_lookup(lut_nibble, nibble_hi);
+    code_hi = vbslq_u8(preamble_mask, spdif_bmc_neon_lookup(lut_preamble, nibble_hi), code_hi);
+
+    // Apply inversion
+    code_lo = veorq_u8(code_lo, vtstq_u8(invert, vdupq_n_u8(0x01)));
+    code_hi = veorq_u8(code_hi, vtstq_u8(invert, vdupq_n_u8(0x10)));
+
+    // Interleave nibble codes to form a 64 bit code per word, then swap to MSB, LSB order
+    uint8x16x2_t code = vzipq_u8(code_lo, code_hi);
+    vst1q_u32(&codes[i].msb, vrev64q_u32(vreinterpretq_u32_u8(code.val[0])));
+    vst1q_u32(&codes[i + 2].msb, vrev64q_u32(vreinterpretq_u32_u8(code.val[1])));
+  }
+
+  // Encode any remainder
+  spdif_bmc_encode_nibble(&data[i], &codes[i], count - i);
+}
+#endif